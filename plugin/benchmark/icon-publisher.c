@@ -0,0 +1,61 @@
+/* A synthetic status icon app for the startup benchmark.
+ *
+ * Usage: icon-publisher <index> <image file>
+ *
+ * Publishes a single XAppStatusIcon, whose kind follows the index so a set
+ * of publishers covers themed, symbolic, file-based and labelled icons. */
+
+#include <stdlib.h>
+
+#include <gtk/gtk.h>
+#include <libxapp/xapp-status-icon.h>
+
+int
+main (int    argc,
+      char **argv)
+{
+    XAppStatusIcon *icon;
+    gchar *name;
+    gint index;
+
+    gtk_init (&argc, &argv);
+
+    if (argc != 3)
+    {
+        g_printerr ("Usage: %s <index> <image file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    index = atoi (argv[1]);
+    name = g_strdup_printf ("benchmark-icon-%d", index);
+
+    icon = xapp_status_icon_new ();
+    xapp_status_icon_set_name (icon, name);
+    xapp_status_icon_set_tooltip_text (icon, name);
+
+    switch (index % 4)
+    {
+        case 0:
+            xapp_status_icon_set_icon_name (icon, "dialog-information");
+            break;
+        case 1:
+            xapp_status_icon_set_icon_name (icon, "audio-volume-high-symbolic");
+            break;
+        case 2:
+            xapp_status_icon_set_icon_name (icon, argv[2]);
+            break;
+        default:
+            xapp_status_icon_set_icon_name (icon, "dialog-information");
+            xapp_status_icon_set_label (icon, argv[1]);
+            break;
+    }
+
+    xapp_status_icon_set_visible (icon, TRUE);
+
+    gtk_main ();
+
+    g_object_unref (icon);
+    g_free (name);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/* Startup benchmark for the plugin, run by 'meson test --benchmark'.
+ *
+ * Usage: plugin-benchmark <plugin module> <icon publisher> <number of icons>
+ *
+ * Everything runs privately, so it works offline and in CI: an Xvfb
+ * display, a dbus-daemon, and empty cache and settings. The plugin module
+ * is loaded into this process the way the panel's wrapper loads it, then
+ * the publishers are spawned, and the time until the plugin has drawn all
+ * of their icons is reported with the process's peak RSS. The plugin's
+ * XAPP_STATUS_PLUGIN_BENCHMARK measurement tells when it is done. */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include <gtk/gtk.h>
+#include <gmodule.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+
+#define PLUGIN_LOG_DOMAIN "XAppStatusPlugin"
+#define BENCHMARK_TIMEOUT 60 /* Seconds */
+#define MONITOR_TIMEOUT   10
+#define MONITOR_NAME      "org.x.StatusIconMonitor"
+
+typedef GType (* PluginInitFunc) (GTypeModule *type_module,
+                                  gboolean    *make_resident);
+
+/* The plugin registers its types in a GTypeModule, like in the panel */
+typedef GTypeModule BenchmarkModule;
+typedef GTypeModuleClass BenchmarkModuleClass;
+
+G_DEFINE_TYPE (BenchmarkModule, benchmark_module, G_TYPE_TYPE_MODULE)
+
+static gboolean
+benchmark_module_load (GTypeModule *module)
+{
+    return TRUE;
+}
+
+static void
+benchmark_module_unload (GTypeModule *module)
+{
+}
+
+static void
+benchmark_module_init (BenchmarkModule *module)
+{
+}
+
+static void
+benchmark_module_class_init (BenchmarkModuleClass *klass)
+{
+    klass->load = benchmark_module_load;
+    klass->unload = benchmark_module_unload;
+}
+
+typedef struct
+{
+    GMainLoop *loop;
+    gint64     start_time;
+    gint64     end_time;
+    gchar     *plugin_message;
+} Benchmark;
+
+static void
+on_plugin_message (const gchar    *log_domain,
+                   GLogLevelFlags  log_level,
+                   const gchar    *message,
+                   gpointer        user_data)
+{
+    Benchmark *benchmark = user_data;
+
+    if (!g_str_has_prefix (message, "Benchmark:"))
+    {
+        g_log_default_handler (log_domain, log_level, message, NULL);
+        return;
+    }
+
+    benchmark->end_time = g_get_monotonic_time ();
+    benchmark->plugin_message = g_strdup (message);
+
+    g_main_loop_quit (benchmark->loop);
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+    Benchmark *benchmark = user_data;
+
+    g_printerr ("Timed out after %d seconds\n", BENCHMARK_TIMEOUT);
+    g_main_loop_quit (benchmark->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Starts a private X server, and points DISPLAY at it */
+static GSubprocess *
+start_xvfb (GError **error)
+{
+    GSubprocessLauncher *launcher;
+    GSubprocess *xvfb;
+    gchar display[32];
+    gchar *value;
+    gint fds[2];
+    gssize length;
+
+    if (!g_unix_open_pipe (fds, FD_CLOEXEC, error))
+    {
+        return NULL;
+    }
+
+    launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_take_fd (launcher, fds[1], 3);
+
+    xvfb = g_subprocess_launcher_spawn (launcher,
+                                        error,
+                                        "Xvfb", "-displayfd", "3",
+                                        "-screen", "0", "1920x200x24",
+                                        "-nolisten", "tcp",
+                                        NULL);
+    g_object_unref (launcher);
+
+    if (xvfb == NULL)
+    {
+        close (fds[0]);
+        return NULL;
+    }
+
+    // Xvfb writes the display number it picked once it is ready.
+    length = read (fds[0], display, sizeof (display) - 1);
+    close (fds[0]);
+
+    if (length <= 0)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Xvfb did not start");
+        g_subprocess_force_exit (xvfb);
+        g_object_unref (xvfb);
+        return NULL;
+    }
+
+    display[length] = '\0';
+    g_strstrip (display);
+
+    value = g_strconcat (":", display, NULL);
+    g_setenv ("DISPLAY", value, TRUE);
+    g_free (value);
+
+    return xvfb;
+}
+
+static gboolean
+write_file_icon (const gchar  *path,
+                 GError      **error)
+{
+    GdkPixbuf *pixbuf;
+    gboolean ret;
+
+    pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+    gdk_pixbuf_fill (pixbuf, 0x3584e4ff);
+
+    ret = gdk_pixbuf_save (pixbuf, path, "png", error, NULL);
+    g_object_unref (pixbuf);
+
+    return ret;
+}
+
+/* Publishers that start before any monitor exists fall back to a
+ * GtkStatusIcon, so wait for the plugin's monitor to be on the bus. */
+static gboolean
+wait_for_monitor (void)
+{
+    GDBusConnection *connection;
+    gint64 deadline;
+    gboolean found = FALSE;
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+
+    if (connection == NULL)
+    {
+        return FALSE;
+    }
+
+    deadline = g_get_monotonic_time () + MONITOR_TIMEOUT * G_USEC_PER_SEC;
+
+    while (!found && g_get_monotonic_time () < deadline)
+    {
+        GVariant *result;
+
+        while (g_main_context_iteration (NULL, FALSE));
+
+        result = g_dbus_connection_call_sync (connection,
+                                              "org.freedesktop.DBus",
+                                              "/org/freedesktop/DBus",
+                                              "org.freedesktop.DBus",
+                                              "ListNames",
+                                              NULL,
+                                              G_VARIANT_TYPE ("(as)"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              NULL,
+                                              NULL);
+
+        if (result != NULL)
+        {
+            GVariantIter *iter;
+            const gchar *name;
+
+            g_variant_get (result, "(as)", &iter);
+
+            while (g_variant_iter_loop (iter, "&s", &name))
+            {
+                found |= g_str_has_prefix (name, MONITOR_NAME);
+            }
+
+            g_variant_iter_free (iter);
+            g_variant_unref (result);
+        }
+
+        if (!found)
+        {
+            g_usleep (10000);
+        }
+    }
+
+    g_object_unref (connection);
+
+    return found;
+}
+
+static GtkWidget *
+load_plugin (const gchar  *module_path,
+             GError      **error)
+{
+    GModule *module;
+    PluginInitFunc init_func;
+    GTypeModule *type_module;
+    gboolean make_resident = TRUE;
+    GType type;
+
+    module = g_module_open (module_path, G_MODULE_BIND_LOCAL);
+
+    if (module == NULL)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", g_module_error ());
+        return NULL;
+    }
+
+    if (!g_module_symbol (module, "xfce_panel_module_init", (gpointer *) &init_func))
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", g_module_error ());
+        g_module_close (module);
+        return NULL;
+    }
+
+    g_module_make_resident (module);
+
+    type_module = g_object_new (benchmark_module_get_type (), NULL);
+    g_type_module_use (type_module);
+    g_type_module_set_name (type_module, "xapp-status-plugin");
+
+    type = init_func (type_module, &make_resident);
+
+    return g_object_new (type,
+                         "name", "xapp-status-plugin",
+                         "unique-id", 1,
+                         "display-name", "XApp Status Plugin",
+                         NULL);
+}
+
+static void
+delete_directory (const gchar *path)
+{
+    const gchar *name;
+    GDir *dir;
+
+    dir = g_dir_open (path, 0, NULL);
+
+    if (dir != NULL)
+    {
+        while ((name = g_dir_read_name (dir)) != NULL)
+        {
+            gchar *child = g_build_filename (path, name, NULL);
+
+            if (g_file_test (child, G_FILE_TEST_IS_DIR))
+            {
+                delete_directory (child);
+            }
+            else
+            {
+                g_unlink (child);
+            }
+
+            g_free (child);
+        }
+
+        g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    Benchmark benchmark = { NULL, };
+    GSubprocess *xvfb = NULL;
+    GTestDBus *bus = NULL;
+    GPtrArray *publishers;
+    GtkWidget *window, *plugin;
+    struct rusage usage;
+    gchar *tmp_dir, *cache_dir, *icon_path, *n_icons_arg;
+    GError *error = NULL;
+    gint n_icons, i;
+    gint status = EXIT_FAILURE;
+
+    if (argc != 4 || (n_icons = atoi (argv[3])) <= 0)
+    {
+        g_printerr ("Usage: %s <plugin module> <icon publisher> <number of icons>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    publishers = g_ptr_array_new_with_free_func (g_object_unref);
+
+    tmp_dir = g_dir_make_tmp ("xapp-status-benchmark-XXXXXX", &error);
+
+    if (tmp_dir == NULL)
+    {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return EXIT_FAILURE;
+    }
+
+    // A cold start: nothing cached, default settings, nothing written to the user's home.
+    cache_dir = g_build_filename (tmp_dir, "cache", NULL);
+    icon_path = g_build_filename (tmp_dir, "file-icon.png", NULL);
+    n_icons_arg = g_strdup_printf ("%d", n_icons);
+
+    g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    g_setenv ("XAPP_STATUS_PLUGIN_BENCHMARK", n_icons_arg, TRUE);
+
+    xvfb = start_xvfb (&error);
+
+    if (xvfb == NULL)
+    {
+        goto out;
+    }
+
+    bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (bus);
+
+    gtk_init (&argc, &argv);
+
+    if (!write_file_icon (icon_path, &error))
+    {
+        goto out;
+    }
+
+    benchmark.loop = g_main_loop_new (NULL, FALSE);
+    g_log_set_handler (PLUGIN_LOG_DOMAIN, G_LOG_LEVEL_MESSAGE, on_plugin_message, &benchmark);
+
+    plugin = load_plugin (argv[1], &error);
+
+    if (plugin == NULL)
+    {
+        goto out;
+    }
+
+    // Realizing the plugin constructs it.
+    window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_default_size (GTK_WINDOW (window), 32, 32);
+    gtk_container_add (GTK_CONTAINER (window), plugin);
+    gtk_widget_show_all (window);
+
+    if (!wait_for_monitor ())
+    {
+        g_set_error (&error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "The plugin's status icon monitor never appeared");
+        goto out;
+    }
+
+    benchmark.start_time = g_get_monotonic_time ();
+
+    for (i = 0; i < n_icons; i++)
+    {
+        GSubprocess *publisher;
+        gchar *index = g_strdup_printf ("%d", i);
+
+        publisher = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, &error, argv[2], index, icon_path, NULL);
+        g_free (index);
+
+        if (publisher == NULL)
+        {
+            goto out;
+        }
+
+        g_ptr_array_add (publishers, publisher);
+    }
+
+    g_timeout_add_seconds (BENCHMARK_TIMEOUT, on_timeout, &benchmark);
+    g_main_loop_run (benchmark.loop);
+
+    if (benchmark.plugin_message == NULL)
+    {
+        goto out;
+    }
+
+    getrusage (RUSAGE_SELF, &usage);
+
+    g_print ("%s\n", benchmark.plugin_message);
+    g_print ("%d icons mapped and drawn %.1f ms after their apps were started, peak RSS %ld KiB\n",
+             n_icons,
+             (benchmark.end_time - benchmark.start_time) / 1000.0,
+             usage.ru_maxrss);
+
+    status = EXIT_SUCCESS;
+
+out:
+    if (error != NULL)
+    {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+    }
+
+    for (i = 0; i < (gint) publishers->len; i++)
+    {
+        g_subprocess_force_exit (g_ptr_array_index (publishers, i));
+    }
+
+    g_ptr_array_unref (publishers);
+
+    if (bus != NULL)
+    {
+        g_test_dbus_down (bus);
+        g_object_unref (bus);
+    }
+
+    if (xvfb != NULL)
+    {
+        g_subprocess_force_exit (xvfb);
+        g_object_unref (xvfb);
+    }
+
+    delete_directory (tmp_dir);
+
+    g_clear_pointer (&benchmark.loop, g_main_loop_unref);
+    g_free (benchmark.plugin_message);
+    g_free (n_icons_arg);
+    g_free (icon_path);
+    g_free (cache_dir);
+    g_free (tmp_dir);
+
+    // The plugin and its window simply die with the process.
+    return status;
+}
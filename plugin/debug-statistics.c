@@ -0,0 +1,135 @@
+#include "debug-statistics.h"
+
+#define STATISTICS_BUS_NAME_PREFIX "org.x.StatusPlugin.Statistics.Plugin"
+#define STATISTICS_OBJECT_PATH     "/org/x/StatusPlugin/Statistics"
+#define STATISTICS_INTERFACE       "org.x.StatusPlugin.Statistics"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" STATISTICS_INTERFACE "'>"
+    "    <method name='GetStatistics'>"
+    "      <arg type='a{sv}' name='plugin' direction='out'/>"
+    "      <arg type='a{sa{sv}}' name='icons' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+struct _DebugStatistics
+{
+    guint owner_id;
+    guint registration_id;
+
+    GDBusConnection *connection;
+    GDBusNodeInfo *node_info;
+
+    DebugStatisticsFunc func;
+    gpointer user_data;
+};
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    DebugStatistics *statistics = user_data;
+
+    if (g_strcmp0 (method_name, "GetStatistics") == 0)
+    {
+        g_dbus_method_invocation_return_value (invocation,
+                                               statistics->func (statistics->user_data));
+        return;
+    }
+
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method: %s", method_name);
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+    handle_method_call,
+    NULL,
+    NULL
+};
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const gchar     *name,
+                 gpointer         user_data)
+{
+    DebugStatistics *statistics = user_data;
+    GError *error;
+
+    error = NULL;
+    statistics->registration_id = g_dbus_connection_register_object (connection,
+                                                                     STATISTICS_OBJECT_PATH,
+                                                                     statistics->node_info->interfaces[0],
+                                                                     &interface_vtable,
+                                                                     statistics,
+                                                                     NULL,
+                                                                     &error);
+
+    if (error)
+    {
+        g_warning ("Could not export the plugin statistics: %s\n", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    statistics->connection = g_object_ref (connection);
+}
+
+DebugStatistics *
+debug_statistics_new (gint                plugin_id,
+                      DebugStatisticsFunc func,
+                      gpointer            user_data)
+{
+    DebugStatistics *statistics;
+    gchar *name;
+
+    g_return_val_if_fail (func != NULL, NULL);
+
+    statistics = g_new0 (DebugStatistics, 1);
+    statistics->func = func;
+    statistics->user_data = user_data;
+    statistics->node_info = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+
+    // Each plugin instance gets its own name, so several panels can be inspected.
+    name = g_strdup_printf (STATISTICS_BUS_NAME_PREFIX "%d", plugin_id);
+
+    statistics->owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+                                           name,
+                                           G_BUS_NAME_OWNER_FLAGS_NONE,
+                                           on_bus_acquired,
+                                           NULL,
+                                           NULL,
+                                           statistics,
+                                           NULL);
+
+    g_free (name);
+
+    return statistics;
+}
+
+void
+debug_statistics_free (DebugStatistics *statistics)
+{
+    g_return_if_fail (statistics != NULL);
+
+    if (statistics->registration_id > 0)
+    {
+        g_dbus_connection_unregister_object (statistics->connection, statistics->registration_id);
+    }
+
+    g_bus_unown_name (statistics->owner_id);
+
+    g_clear_object (&statistics->connection);
+    g_dbus_node_info_unref (statistics->node_info);
+    g_free (statistics);
+}
@@ -0,0 +1,29 @@
+#ifndef _DEBUG_STATISTICS_H_
+#define _DEBUG_STATISTICS_H_
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Exports the plugin's runtime counters on the session bus, as
+ * org.x.StatusPlugin.Statistics.Plugin<id> at /org/x/StatusPlugin/Statistics:
+ *
+ *   gdbus call --session --dest org.x.StatusPlugin.Statistics.Plugin<id> \
+ *              --object-path /org/x/StatusPlugin/Statistics \
+ *              --method org.x.StatusPlugin.Statistics.GetStatistics
+ *
+ * The callback builds the (a{sv}a{sa{sv}}) reply, global counters first
+ * and then the counters of each icon. */
+
+typedef struct _DebugStatistics DebugStatistics;
+
+typedef GVariant * (* DebugStatisticsFunc) (gpointer user_data);
+
+DebugStatistics *debug_statistics_new  (gint                 plugin_id,
+                                        DebugStatisticsFunc  func,
+                                        gpointer             user_data);
+void             debug_statistics_free (DebugStatistics     *statistics);
+
+G_END_DECLS
+
+#endif /*_DEBUG_STATISTICS_H_ */
@@ -0,0 +1,250 @@
+#include "decode-pool.h"
+#include "profiling.h"
+
+#define DECODE_POOL_MAX_THREADS 2
+
+#define PRIORITY_HIGH 0
+#define PRIORITY_LOW  1
+
+struct _DecodeSlot
+{
+    gint ref_count;
+
+    /* Protected by slot_lock, only ever changed from the main thread */
+    gchar   *path;
+    gint     width, height, scale;
+    guint    generation;
+    gboolean queued;
+
+    gint priority; /* Atomic, read by the pool's sort function */
+
+    /* Main thread only, cleared once the slot is freed */
+    DecodeSlotFunc func;
+    gpointer       user_data;
+    gint64         decode_time; /* Of the last delivered result */
+};
+
+typedef struct
+{
+    DecodeSlot *slot;
+    guint       generation;
+    GdkPixbuf  *pixbuf;
+    GError     *error;
+    gint64      decode_time;
+} DecodeResult;
+
+G_LOCK_DEFINE_STATIC (slot_lock);
+
+static GThreadPool *pool = NULL;
+
+static DecodeSlot *
+decode_slot_ref (DecodeSlot *slot)
+{
+    g_atomic_int_inc (&slot->ref_count);
+
+    return slot;
+}
+
+static void
+decode_slot_unref (DecodeSlot *slot)
+{
+    if (!g_atomic_int_dec_and_test (&slot->ref_count))
+    {
+        return;
+    }
+
+    g_free (slot->path);
+    g_free (slot);
+}
+
+static gboolean
+deliver_result (gpointer data)
+{
+    DecodeResult *result = data;
+    DecodeSlot *slot = result->slot;
+
+    // The generation only changes on the main thread, no need to lock.
+    if (slot->func != NULL && result->generation == slot->generation)
+    {
+        slot->decode_time = result->decode_time;
+        slot->func (slot, result->pixbuf, result->error, slot->user_data);
+    }
+
+    g_clear_object (&result->pixbuf);
+    g_clear_error (&result->error);
+    decode_slot_unref (slot);
+    g_free (result);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+decode_thread (gpointer data,
+               gpointer user_data)
+{
+    DecodeSlot *slot = data;
+    DecodeResult *result;
+    gchar *path;
+    gint width, height, scale;
+    guint generation;
+
+    G_LOCK (slot_lock);
+
+    slot->queued = FALSE;
+    path = g_strdup (slot->path);
+    width = slot->width;
+    height = slot->height;
+    scale = slot->scale;
+    generation = slot->generation;
+
+    G_UNLOCK (slot_lock);
+
+    // Cancelled while it was waiting in the queue
+    if (path == NULL)
+    {
+        decode_slot_unref (slot);
+        return;
+    }
+
+    result = g_new0 (DecodeResult, 1);
+    result->slot = slot;
+    result->generation = generation;
+    result->decode_time = g_get_monotonic_time ();
+
+    PROFILE_BEGIN (profile_begin);
+
+    /* Pixbuf size is multiplied by the ui scale */
+    result->pixbuf = gdk_pixbuf_new_from_file_at_scale (path,
+                                                        width > 0 ? width * scale : -1,
+                                                        height > 0 ? height * scale : -1,
+                                                        TRUE,
+                                                        &result->error);
+
+    PROFILE_END (profile_begin, "decode-image", path);
+
+    result->decode_time = g_get_monotonic_time () - result->decode_time;
+
+    g_free (path);
+
+    g_idle_add_full (G_PRIORITY_DEFAULT, deliver_result, result, NULL);
+}
+
+static gint
+compare_priority (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+    DecodeSlot *slot_a = (DecodeSlot *) a;
+    DecodeSlot *slot_b = (DecodeSlot *) b;
+
+    return g_atomic_int_get (&slot_a->priority) - g_atomic_int_get (&slot_b->priority);
+}
+
+static void
+ensure_pool (void)
+{
+    if (pool != NULL)
+    {
+        return;
+    }
+
+    /* A non-exclusive pool can't fail to be created */
+    pool = g_thread_pool_new (decode_thread,
+                              NULL,
+                              DECODE_POOL_MAX_THREADS,
+                              FALSE,
+                              NULL);
+
+    g_thread_pool_set_sort_function (pool, compare_priority, NULL);
+}
+
+DecodeSlot *
+decode_slot_new (DecodeSlotFunc func,
+                 gpointer       user_data)
+{
+    DecodeSlot *slot;
+
+    slot = g_new0 (DecodeSlot, 1);
+    slot->ref_count = 1;
+    slot->priority = PRIORITY_LOW;
+    slot->func = func;
+    slot->user_data = user_data;
+
+    return slot;
+}
+
+void
+decode_slot_free (DecodeSlot *slot)
+{
+    g_return_if_fail (slot != NULL);
+
+    decode_slot_cancel (slot);
+
+    slot->func = NULL;
+    slot->user_data = NULL;
+
+    decode_slot_unref (slot);
+}
+
+void
+decode_slot_request (DecodeSlot  *slot,
+                     const gchar *path,
+                     gint         width,
+                     gint         height,
+                     gint         scale,
+                     gboolean     high_priority)
+{
+    gboolean push;
+
+    g_return_if_fail (slot != NULL);
+    g_return_if_fail (path != NULL);
+
+    g_atomic_int_set (&slot->priority, high_priority ? PRIORITY_HIGH : PRIORITY_LOW);
+
+    G_LOCK (slot_lock);
+
+    g_free (slot->path);
+    slot->path = g_strdup (path);
+    slot->width = width;
+    slot->height = height;
+    slot->scale = scale;
+    slot->generation++;
+
+    // A slot that is still waiting in the queue simply picks up the new request.
+    push = !slot->queued;
+    slot->queued = TRUE;
+
+    G_UNLOCK (slot_lock);
+
+    if (!push)
+    {
+        return;
+    }
+
+    ensure_pool ();
+
+    g_thread_pool_push (pool, decode_slot_ref (slot), NULL);
+}
+
+void
+decode_slot_cancel (DecodeSlot *slot)
+{
+    g_return_if_fail (slot != NULL);
+
+    G_LOCK (slot_lock);
+
+    g_clear_pointer (&slot->path, g_free);
+    slot->generation++;
+
+    G_UNLOCK (slot_lock);
+}
+
+/* How long the result being delivered took to decode, in microseconds.
+ * Only meaningful from within the slot's callback. */
+gint64
+decode_slot_get_decode_time (DecodeSlot *slot)
+{
+    g_return_val_if_fail (slot != NULL, 0);
+
+    return slot->decode_time;
+}
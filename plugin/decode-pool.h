@@ -0,0 +1,42 @@
+#ifndef _DECODE_POOL_H_
+#define _DECODE_POOL_H_
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* A small, fixed-size pool of threads decoding image files.
+ *
+ * Each consumer owns a DecodeSlot, which holds at most one pending decode:
+ * a new request replaces one that hasn't started yet, and the result of any
+ * request that was superseded or cancelled is dropped. High priority requests
+ * (for visible icons) are decoded before the others.
+ *
+ * Slots must only be used from the main thread, and the callback is always
+ * invoked there. */
+
+typedef struct _DecodeSlot DecodeSlot;
+
+typedef void (* DecodeSlotFunc) (DecodeSlot   *slot,
+                                 GdkPixbuf    *pixbuf,
+                                 const GError *error,
+                                 gpointer      user_data);
+
+DecodeSlot *decode_slot_new     (DecodeSlotFunc  func,
+                                 gpointer        user_data);
+void        decode_slot_free    (DecodeSlot     *slot);
+
+void        decode_slot_request (DecodeSlot     *slot,
+                                 const gchar    *path,
+                                 gint            width,
+                                 gint            height,
+                                 gint            scale,
+                                 gboolean        high_priority);
+void        decode_slot_cancel  (DecodeSlot     *slot);
+
+gint64      decode_slot_get_decode_time (DecodeSlot *slot);
+
+G_END_DECLS
+
+#endif /*_DECODE_POOL_H_ */
@@ -0,0 +1,323 @@
+#include "icon-animation.h"
+#include "decode-pool.h"
+
+#define MAX_FRAMES       60
+#define MIN_INTERVAL     16 /* ms, about one frame */
+#define DEFAULT_INTERVAL 100
+
+typedef struct
+{
+    IconAnimation   *animation;
+    gchar           *name;
+    cairo_surface_t *surface;
+    DecodeSlot      *decode_slot;
+    gboolean         recolor; /* A symbolic theme icon, painted in the widget's color */
+} AnimationFrame;
+
+struct _IconAnimation
+{
+    AnimationFrame *frames;
+    guint           n_frames;
+    gint            interval;
+    gint64          start_time;
+
+    /* What the frames are currently loaded for */
+    GtkWidget      *widget;
+    gint            color_icon_size;
+    gint            symbolic_icon_size;
+    gint            scale;
+};
+
+static gint
+get_frame_size (IconAnimation *animation,
+                const gchar   *name)
+{
+    gboolean is_symbolic = !!g_strstr_len (name, -1, "-symbolic");
+
+    return is_symbolic ? animation->symbolic_icon_size : animation->color_icon_size;
+}
+
+/* Paints the frame's shape in the foreground color, the way symbolic
+ * icons follow the panel's theme. Only a mask, so cheap enough for the
+ * main thread. */
+static cairo_surface_t *
+recolor_symbolic_frame (IconAnimation   *animation,
+                        cairo_surface_t *source,
+                        gint             width,
+                        gint             height)
+{
+    GtkStyleContext *context;
+    cairo_surface_t *surface;
+    GdkRGBA color;
+    cairo_t *cr;
+
+    context = gtk_widget_get_style_context (animation->widget);
+    gtk_style_context_get_color (context, gtk_style_context_get_state (context), &color);
+
+    surface = cairo_surface_create_similar_image (source, CAIRO_FORMAT_ARGB32, width, height);
+    cairo_surface_set_device_scale (surface, animation->scale, animation->scale);
+
+    cr = cairo_create (surface);
+    gdk_cairo_set_source_rgba (cr, &color);
+    cairo_mask_surface (cr, source, 0, 0);
+    cairo_destroy (cr);
+
+    return surface;
+}
+
+static void
+on_frame_decoded (DecodeSlot   *slot,
+                  GdkPixbuf    *pixbuf,
+                  const GError *error,
+                  gpointer      user_data)
+{
+    AnimationFrame *frame = user_data;
+    IconAnimation *animation = frame->animation;
+    cairo_surface_t *surface;
+
+    if (error)
+    {
+        g_warning ("Could not load animation frame '%s': %s\n", frame->name, error->message);
+        return;
+    }
+
+    surface = gdk_cairo_surface_create_from_pixbuf (pixbuf,
+                                                    animation->scale,
+                                                    gtk_widget_get_window (animation->widget));
+
+    if (frame->recolor)
+    {
+        frame->surface = recolor_symbolic_frame (animation,
+                                                 surface,
+                                                 gdk_pixbuf_get_width (pixbuf),
+                                                 gdk_pixbuf_get_height (pixbuf));
+        cairo_surface_destroy (surface);
+        return;
+    }
+
+    frame->surface = surface;
+}
+
+/* Finds the file behind a themed frame, to decode it in the background.
+ * The theme lookup itself only reads the theme's index. */
+static gchar *
+lookup_themed_frame (IconAnimation *animation,
+                     const gchar   *name)
+{
+    GtkIconInfo *info;
+    gchar *path;
+
+    info = gtk_icon_theme_lookup_icon_for_scale (gtk_icon_theme_get_default (),
+                                                 name,
+                                                 get_frame_size (animation, name),
+                                                 animation->scale,
+                                                 GTK_ICON_LOOKUP_FORCE_SIZE);
+
+    if (info == NULL)
+    {
+        return NULL;
+    }
+
+    path = g_strdup (gtk_icon_info_get_filename (info));
+    g_object_unref (info);
+
+    return path;
+}
+
+static cairo_surface_t *
+load_themed_frame (IconAnimation *animation,
+                   const gchar   *name)
+{
+    GtkIconInfo *info;
+    GdkPixbuf *pixbuf;
+    cairo_surface_t *surface;
+    GError *error;
+
+    info = gtk_icon_theme_lookup_icon_for_scale (gtk_icon_theme_get_default (),
+                                                 name,
+                                                 get_frame_size (animation, name),
+                                                 animation->scale,
+                                                 GTK_ICON_LOOKUP_FORCE_SIZE);
+
+    if (info == NULL)
+    {
+        g_warning ("Could not find animation frame '%s' in the icon theme\n", name);
+        return NULL;
+    }
+
+    error = NULL;
+    // Recolors symbolic frames to match the panel, other frames are loaded as they are.
+    pixbuf = gtk_icon_info_load_symbolic_for_context (info,
+                                                      gtk_widget_get_style_context (animation->widget),
+                                                      NULL,
+                                                      &error);
+    g_object_unref (info);
+
+    if (error)
+    {
+        g_warning ("Could not load animation frame '%s': %s\n", name, error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    surface = gdk_cairo_surface_create_from_pixbuf (pixbuf,
+                                                    animation->scale,
+                                                    gtk_widget_get_window (animation->widget));
+    g_object_unref (pixbuf);
+
+    return surface;
+}
+
+IconAnimation *
+icon_animation_new (const gchar * const *frame_names,
+                    gint                 interval)
+{
+    IconAnimation *animation;
+    guint i;
+
+    g_return_val_if_fail (frame_names != NULL && frame_names[0] != NULL, NULL);
+
+    animation = g_new0 (IconAnimation, 1);
+    animation->n_frames = MIN (g_strv_length ((gchar **) frame_names), MAX_FRAMES);
+    animation->frames = g_new0 (AnimationFrame, animation->n_frames);
+    animation->interval = interval > 0 ? MAX (interval, MIN_INTERVAL) : DEFAULT_INTERVAL;
+
+    for (i = 0; i < animation->n_frames; i++)
+    {
+        animation->frames[i].animation = animation;
+        animation->frames[i].name = g_strdup (frame_names[i]);
+    }
+
+    return animation;
+}
+
+void
+icon_animation_free (IconAnimation *animation)
+{
+    guint i;
+
+    g_return_if_fail (animation != NULL);
+
+    for (i = 0; i < animation->n_frames; i++)
+    {
+        AnimationFrame *frame = &animation->frames[i];
+
+        g_clear_pointer (&frame->decode_slot, decode_slot_free);
+        g_clear_pointer (&frame->surface, cairo_surface_destroy);
+        g_free (frame->name);
+    }
+
+    g_free (animation->frames);
+    g_free (animation);
+}
+
+/* Decodes every frame for the widget's scale and the given sizes, unless
+ * they are already loaded for those. Frames are decoded in the background,
+ * only themed icons without a file of their own (built into GTK) are loaded
+ * right away. */
+void
+icon_animation_load (IconAnimation *animation,
+                     GtkWidget     *widget,
+                     gint           color_icon_size,
+                     gint           symbolic_icon_size)
+{
+    gint scale;
+    guint i;
+
+    g_return_if_fail (animation != NULL);
+    g_return_if_fail (GTK_IS_WIDGET (widget));
+
+    scale = gtk_widget_get_scale_factor (widget);
+
+    if (animation->widget == widget &&
+        animation->color_icon_size == color_icon_size &&
+        animation->symbolic_icon_size == symbolic_icon_size &&
+        animation->scale == scale)
+    {
+        return;
+    }
+
+    animation->widget = widget;
+    animation->color_icon_size = color_icon_size;
+    animation->symbolic_icon_size = symbolic_icon_size;
+    animation->scale = scale;
+
+    for (i = 0; i < animation->n_frames; i++)
+    {
+        AnimationFrame *frame = &animation->frames[i];
+
+        gchar *path;
+
+        g_clear_pointer (&frame->surface, cairo_surface_destroy);
+
+        if (strchr (frame->name, G_DIR_SEPARATOR) == NULL)
+        {
+            path = lookup_themed_frame (animation, frame->name);
+
+            if (path == NULL)
+            {
+                if (frame->decode_slot != NULL)
+                {
+                    decode_slot_cancel (frame->decode_slot);
+                }
+
+                frame->surface = load_themed_frame (animation, frame->name);
+                continue;
+            }
+
+            frame->recolor = g_str_has_suffix (frame->name, "-symbolic");
+        }
+        else
+        {
+            path = g_strdup (frame->name);
+        }
+
+        if (frame->decode_slot == NULL)
+        {
+            frame->decode_slot = decode_slot_new (on_frame_decoded, frame);
+        }
+
+        decode_slot_request (frame->decode_slot,
+                             path,
+                             -1,
+                             get_frame_size (animation, frame->name),
+                             scale,
+                             gtk_widget_get_visible (widget));
+
+        g_free (path);
+    }
+}
+
+/* Returns the frame to show at frame_time, or NULL if it isn't loaded yet.
+ * The surface is owned by the animation. */
+cairo_surface_t *
+icon_animation_get_frame (IconAnimation *animation,
+                          gint64         frame_time)
+{
+    gint64 elapsed;
+
+    g_return_val_if_fail (animation != NULL, NULL);
+
+    if (animation->start_time == 0)
+    {
+        animation->start_time = frame_time;
+    }
+
+    elapsed = (frame_time - animation->start_time) / 1000;
+
+    return animation->frames[(elapsed / animation->interval) % animation->n_frames].surface;
+}
+
+/* When the frame after the one shown at frame_time is due */
+gint64
+icon_animation_get_next_frame_time (IconAnimation *animation,
+                                    gint64         frame_time)
+{
+    gint64 interval;
+
+    g_return_val_if_fail (animation != NULL, frame_time);
+
+    interval = (gint64) animation->interval * 1000;
+
+    return frame_time + interval - (frame_time - animation->start_time) % interval;
+}
@@ -0,0 +1,32 @@
+#ifndef _ICON_ANIMATION_H_
+#define _ICON_ANIMATION_H_
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* An animation declared by an app in its icon metadata, as a list of
+ * themed icon names or file paths and a frame interval. Frames are
+ * decoded once for a given size and scale, and are then picked from the
+ * frame clock's time, so playing the animation needs no D-Bus traffic
+ * and no further decoding. */
+
+typedef struct _IconAnimation IconAnimation;
+
+IconAnimation   *icon_animation_new       (const gchar * const *frame_names,
+                                           gint                 interval);
+void             icon_animation_free      (IconAnimation       *animation);
+
+void             icon_animation_load      (IconAnimation       *animation,
+                                           GtkWidget           *widget,
+                                           gint                 color_icon_size,
+                                           gint                 symbolic_icon_size);
+
+cairo_surface_t *icon_animation_get_frame (IconAnimation       *animation,
+                                           gint64               frame_time);
+gint64           icon_animation_get_next_frame_time (IconAnimation *animation,
+                                                     gint64         frame_time);
+
+G_END_DECLS
+
+#endif /*_ICON_ANIMATION_H_ */
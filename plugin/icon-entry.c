@@ -0,0 +1,263 @@
+#include <string.h>
+
+#include "icon-entry.h"
+
+/* Placeholders have no proxy yet, their values come from the snapshot */
+static const gchar *
+get_name (IconEntry *entry)
+{
+    const gchar *name;
+
+    if (entry->proxy == NULL)
+    {
+        name = entry->placeholder->name;
+    }
+    else
+    {
+        name = xapp_status_icon_interface_get_name (entry->proxy);
+    }
+
+    return name != NULL ? name : "";
+}
+
+static const gchar *
+get_icon_name (IconEntry *entry)
+{
+    if (entry->proxy == NULL)
+    {
+        return entry->placeholder->icon_name;
+    }
+
+    return xapp_status_icon_interface_get_icon_name (entry->proxy);
+}
+
+static gboolean
+icon_name_is_symbolic (IconEntry *entry)
+{
+    const gchar *icon_name = get_icon_name (entry);
+
+    return icon_name != NULL && g_strstr_len (icon_name, -1, "symbolic") != NULL;
+}
+
+/* The app's name and object path, identifying an icon across sessions */
+gchar *
+icon_entry_make_key (XAppStatusIconInterface *proxy)
+{
+    const gchar *name = xapp_status_icon_interface_get_name (proxy);
+
+    return g_strconcat (name != NULL ? name : "", g_dbus_proxy_get_object_path (G_DBUS_PROXY (proxy)), NULL);
+}
+
+static void
+update_sort_keys (IconEntry *entry)
+{
+    gchar *unique_key;
+
+    if (entry->proxy == NULL)
+    {
+        unique_key = g_strdup (entry->placeholder->key);
+    }
+    else
+    {
+        unique_key = icon_entry_make_key (entry->proxy);
+    }
+
+    g_free (entry->name_collate_key);
+    g_free (entry->unique_collate_key);
+
+    entry->name_collate_key = g_utf8_collate_key (get_name (entry), -1);
+    entry->unique_collate_key = g_utf8_collate_key (unique_key, -1);
+    entry->is_symbolic = icon_name_is_symbolic (entry);
+
+    g_free (unique_key);
+}
+
+static gboolean
+name_changed (GVariant            *changed_properties,
+              const gchar * const *invalidated_properties)
+{
+    GVariant *value;
+
+    value = g_variant_lookup_value (changed_properties, "Name", NULL);
+
+    if (value != NULL)
+    {
+        g_variant_unref (value);
+        return TRUE;
+    }
+
+    for (; invalidated_properties != NULL && *invalidated_properties != NULL; invalidated_properties++)
+    {
+        if (g_strcmp0 (*invalidated_properties, "Name") == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+on_proxy_properties_changed (GDBusProxy          *proxy,
+                             GVariant            *changed_properties,
+                             const gchar * const *invalidated_properties,
+                             gpointer             user_data)
+{
+    IconEntry *entry = user_data;
+    gboolean visible, changed = FALSE;
+
+    // A new name recomputes every sort key, the symbolic flag included.
+    if (name_changed (changed_properties, invalidated_properties))
+    {
+        update_sort_keys (entry);
+        changed = TRUE;
+    }
+    else
+    if (icon_name_is_symbolic (entry) != entry->is_symbolic)
+    {
+        entry->is_symbolic = !entry->is_symbolic;
+        changed = TRUE;
+    }
+
+    visible = xapp_status_icon_interface_get_visible (entry->proxy);
+
+    if (visible != entry->visible)
+    {
+        entry->visible = visible;
+        changed = TRUE;
+    }
+
+    if (changed)
+    {
+        entry->changed_func (entry, entry->user_data);
+    }
+}
+
+static void
+bind_proxy (IconEntry *entry)
+{
+    entry->visible = xapp_status_icon_interface_get_visible (entry->proxy);
+
+    g_signal_connect (entry->proxy, "g-properties-changed", G_CALLBACK (on_proxy_properties_changed), entry);
+}
+
+IconEntry *
+icon_entry_new (XAppStatusIconInterface *proxy,
+                IconEntryChangedFunc     changed_func,
+                gpointer                 user_data)
+{
+    IconEntry *entry = g_slice_new0 (IconEntry);
+
+    entry->proxy = g_object_ref (proxy);
+    entry->key = icon_entry_make_key (proxy);
+    entry->changed_func = changed_func;
+    entry->user_data = user_data;
+
+    bind_proxy (entry);
+    update_sort_keys (entry);
+
+    return entry;
+}
+
+IconEntry *
+icon_entry_new_placeholder (const IconSnapshotEntry *snapshot,
+                            IconEntryChangedFunc     changed_func,
+                            gpointer                 user_data)
+{
+    IconEntry *entry = g_slice_new0 (IconEntry);
+
+    entry->placeholder = icon_snapshot_entry_copy (snapshot);
+    entry->key = g_strdup (snapshot->key);
+    entry->visible = TRUE;
+    entry->changed_func = changed_func;
+    entry->user_data = user_data;
+
+    update_sort_keys (entry);
+
+    return entry;
+}
+
+/* The plugin must have dropped the entry's widget already */
+void
+icon_entry_free (IconEntry *entry)
+{
+    if (entry->proxy != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (entry->proxy, entry);
+        g_object_unref (entry->proxy);
+    }
+
+    g_clear_pointer (&entry->placeholder, icon_snapshot_entry_free);
+
+    g_free (entry->key);
+    g_free (entry->name_collate_key);
+    g_free (entry->unique_collate_key);
+
+    g_slice_free (IconEntry, entry);
+}
+
+/* The app of a placeholder showed up. The caller hands the proxy to the
+ * entry's widget, if it has one, and places the entry again in case the
+ * app's name changed since the snapshot. */
+void
+icon_entry_set_proxy (IconEntry               *entry,
+                      XAppStatusIconInterface *proxy)
+{
+    g_return_if_fail (entry->proxy == NULL);
+
+    entry->proxy = g_object_ref (proxy);
+    g_clear_pointer (&entry->placeholder, icon_snapshot_entry_free);
+
+    bind_proxy (entry);
+    update_sort_keys (entry);
+}
+
+IconSnapshotEntry *
+icon_entry_get_snapshot (IconEntry *entry)
+{
+    IconSnapshotEntry *snapshot;
+    const gchar *label;
+
+    if (entry->proxy == NULL)
+    {
+        return icon_snapshot_entry_copy (entry->placeholder);
+    }
+
+    label = xapp_status_icon_interface_get_label (entry->proxy);
+
+    snapshot = g_slice_new0 (IconSnapshotEntry);
+    snapshot->key = g_strdup (entry->key);
+    snapshot->name = g_strdup (get_name (entry));
+    snapshot->icon_name = g_strdup (get_icon_name (entry));
+    snapshot->label = g_strdup (label != NULL ? label : "");
+
+    return snapshot;
+}
+
+/* Symbolic icons go after color ones, then icons are ordered by name
+ * and finally by their name and object path, using the cached keys. */
+gint
+icon_entry_compare (const IconEntry *a,
+                    const IconEntry *b)
+{
+    gint res;
+
+    if (a->is_symbolic && !b->is_symbolic)
+    {
+        return 1;
+    }
+
+    if (b->is_symbolic && !a->is_symbolic)
+    {
+        return -1;
+    }
+
+    res = strcmp (a->name_collate_key, b->name_collate_key);
+
+    if (res != 0)
+    {
+        return res;
+    }
+
+    return strcmp (a->unique_collate_key, b->unique_collate_key);
+}
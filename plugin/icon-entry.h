@@ -0,0 +1,64 @@
+#ifndef _ICON_ENTRY_H_
+#define _ICON_ENTRY_H_
+
+#include <glib.h>
+#include <libxapp/xapp-statusicon-interface.h>
+
+#include "status-icon.h"
+#include "icon-snapshot.h"
+
+G_BEGIN_DECLS
+
+/* What the plugin keeps for each icon whether or not it has a widget: its
+ * proxy (or the snapshot of a placeholder), its visibility and its sort
+ * keys. Icons that overflow only have this, so their cost doesn't depend on
+ * what a StatusIcon holds. */
+
+typedef struct _IconEntry IconEntry;
+
+/* Called when the entry's place in the order or its visibility changed */
+typedef void (* IconEntryChangedFunc) (IconEntry *entry,
+                                       gpointer   user_data);
+
+struct _IconEntry
+{
+    gchar                   *key;          /* The plugin's lookup key, the app's name and object path */
+    XAppStatusIconInterface *proxy;        /* NULL for a placeholder */
+    IconSnapshotEntry       *placeholder;  /* Values shown until the proxy arrives */
+
+    gboolean                 visible;
+
+    /* Sort keys, refreshed only when the name or icon name changes */
+    gchar                   *name_collate_key;
+    gchar                   *unique_collate_key;
+    gboolean                 is_symbolic;
+
+    /* Owned by the plugin */
+    StatusIcon              *icon;         /* NULL while overflowed with the popover closed */
+    GSequenceIter           *iter;
+    gint                     length;       /* Along the panel, when it last had a widget */
+    StatusIconStats          stats;        /* Counted by its widgets, kept across them */
+
+    IconEntryChangedFunc     changed_func;
+    gpointer                 user_data;
+};
+
+gchar             *icon_entry_make_key        (XAppStatusIconInterface *proxy);
+
+IconEntry         *icon_entry_new             (XAppStatusIconInterface *proxy,
+                                               IconEntryChangedFunc     changed_func,
+                                               gpointer                 user_data);
+IconEntry         *icon_entry_new_placeholder (const IconSnapshotEntry *snapshot,
+                                               IconEntryChangedFunc     changed_func,
+                                               gpointer                 user_data);
+void               icon_entry_free            (IconEntry               *entry);
+
+void               icon_entry_set_proxy       (IconEntry               *entry,
+                                               XAppStatusIconInterface *proxy);
+IconSnapshotEntry *icon_entry_get_snapshot    (IconEntry               *entry);
+gint               icon_entry_compare         (const IconEntry         *a,
+                                               const IconEntry         *b);
+
+G_END_DECLS
+
+#endif /*_ICON_ENTRY_H_ */
@@ -0,0 +1,145 @@
+#include <libxapp/xapp-status-icon-monitor.h>
+
+#include "icon-registry.h"
+
+enum
+{
+    ICON_ADDED,
+    ICON_REMOVED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = {0, };
+
+struct _IconRegistry
+{
+    GObject parent_instance;
+
+    XAppStatusIconMonitor *monitor;
+
+    /* The proxies currently known, in the order they appeared */
+    GQueue icons;
+};
+
+G_DEFINE_TYPE (IconRegistry, icon_registry, G_TYPE_OBJECT)
+
+static IconRegistry *default_registry = NULL;
+
+static void
+on_monitor_icon_added (XAppStatusIconMonitor   *monitor,
+                       XAppStatusIconInterface *proxy,
+                       gpointer                 user_data)
+{
+    IconRegistry *registry = ICON_REGISTRY (user_data);
+
+    if (g_queue_find (&registry->icons, proxy) != NULL)
+    {
+        return;
+    }
+
+    g_queue_push_tail (&registry->icons, g_object_ref (proxy));
+
+    g_signal_emit (registry, signals[ICON_ADDED], 0, proxy);
+}
+
+static void
+on_monitor_icon_removed (XAppStatusIconMonitor   *monitor,
+                         XAppStatusIconInterface *proxy,
+                         gpointer                 user_data)
+{
+    IconRegistry *registry = ICON_REGISTRY (user_data);
+
+    if (!g_queue_remove (&registry->icons, proxy))
+    {
+        return;
+    }
+
+    // Views may still look at the proxy while handling the signal.
+    g_signal_emit (registry, signals[ICON_REMOVED], 0, proxy);
+
+    g_object_unref (proxy);
+}
+
+static void
+icon_registry_init (IconRegistry *registry)
+{
+    g_queue_init (&registry->icons);
+
+    registry->monitor = xapp_status_icon_monitor_new ();
+
+    g_signal_connect (registry->monitor,
+                      "icon-added",
+                      G_CALLBACK (on_monitor_icon_added),
+                      registry);
+
+    g_signal_connect (registry->monitor,
+                      "icon-removed",
+                      G_CALLBACK (on_monitor_icon_removed),
+                      registry);
+}
+
+static void
+icon_registry_dispose (GObject *object)
+{
+    IconRegistry *registry = ICON_REGISTRY (object);
+
+    if (registry->monitor != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (registry->monitor, registry);
+        g_clear_object (&registry->monitor);
+    }
+
+    g_queue_foreach (&registry->icons, (GFunc) g_object_unref, NULL);
+    g_queue_clear (&registry->icons);
+
+    G_OBJECT_CLASS (icon_registry_parent_class)->dispose (object);
+}
+
+static void
+icon_registry_class_init (IconRegistryClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = icon_registry_dispose;
+
+    signals [ICON_ADDED] =
+    g_signal_new ("icon-added",
+                  ICON_TYPE_REGISTRY,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, XAPP_TYPE_STATUS_ICON_INTERFACE);
+
+    signals [ICON_REMOVED] =
+    g_signal_new ("icon-removed",
+                  ICON_TYPE_REGISTRY,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, XAPP_TYPE_STATUS_ICON_INTERFACE);
+}
+
+IconRegistry *
+icon_registry_get (void)
+{
+    if (default_registry != NULL)
+    {
+        return g_object_ref (default_registry);
+    }
+
+    default_registry = g_object_new (ICON_TYPE_REGISTRY, NULL);
+    g_object_add_weak_pointer (G_OBJECT (default_registry), (gpointer *) &default_registry);
+
+    return default_registry;
+}
+
+/* Returns the proxies known so far, for a view subscribing after they
+ * appeared. Free the list with g_list_free(), the proxies stay owned by
+ * the registry. */
+GList *
+icon_registry_get_icons (IconRegistry *registry)
+{
+    g_return_val_if_fail (ICON_IS_REGISTRY (registry), NULL);
+
+    return g_list_copy (registry->icons.head);
+}
@@ -0,0 +1,26 @@
+#ifndef _ICON_REGISTRY_H_
+#define _ICON_REGISTRY_H_
+
+#include <glib-object.h>
+#include <libxapp/xapp-statusicon-interface.h>
+
+G_BEGIN_DECLS
+
+#define ICON_TYPE_REGISTRY (icon_registry_get_type ())
+
+G_DECLARE_FINAL_TYPE (IconRegistry, icon_registry, ICON, REGISTRY, GObject)
+
+/* Owns the one XAppStatusIconMonitor of the process and the proxies it
+ * finds, so every plugin instance in the process shares them. Instances
+ * are views on it: they connect to "icon-added" and "icon-removed", and
+ * catch up with icon_registry_get_icons() when they subscribe late.
+ *
+ * icon_registry_get() returns a new reference, the registry and its
+ * monitor go away with the last one. */
+
+IconRegistry *icon_registry_get       (void);
+GList        *icon_registry_get_icons (IconRegistry *registry);
+
+G_END_DECLS
+
+#endif /*_ICON_REGISTRY_H_ */
@@ -0,0 +1,263 @@
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "icon-snapshot.h"
+
+#define SNAPSHOT_VERSION 1
+
+static gchar *
+get_snapshot_path (gint plugin_id)
+{
+    gchar *basename, *path;
+
+    basename = g_strdup_printf ("snapshot-%d.json", plugin_id);
+    path = g_build_filename (g_get_user_cache_dir (), "xfce4-xapp-status-plugin", basename, NULL);
+
+    g_free (basename);
+
+    return path;
+}
+
+IconSnapshotEntry *
+icon_snapshot_entry_copy (const IconSnapshotEntry *entry)
+{
+    IconSnapshotEntry *copy = g_slice_new0 (IconSnapshotEntry);
+
+    copy->key = g_strdup (entry->key);
+    copy->name = g_strdup (entry->name);
+    copy->icon_name = g_strdup (entry->icon_name);
+    copy->label = g_strdup (entry->label);
+
+    return copy;
+}
+
+void
+icon_snapshot_entry_free (IconSnapshotEntry *entry)
+{
+    g_free (entry->key);
+    g_free (entry->name);
+    g_free (entry->icon_name);
+    g_free (entry->label);
+    g_slice_free (IconSnapshotEntry, entry);
+}
+
+static gchar *
+read_string_member (JsonReader  *reader,
+                    const gchar *member)
+{
+    gchar *value = NULL;
+
+    if (json_reader_read_member (reader, member))
+    {
+        value = g_strdup (json_reader_get_string_value (reader));
+    }
+    json_reader_end_member (reader);
+
+    return value;
+}
+
+/* Returns the saved entries in display order, or NULL if there is no
+ * usable snapshot */
+GList *
+icon_snapshot_load (gint plugin_id)
+{
+    g_autoptr (JsonParser) parser = NULL;
+    g_autoptr (JsonReader) reader = NULL;
+    GList *entries = NULL;
+    gchar *path;
+    gint i, n_icons;
+
+    path = get_snapshot_path (plugin_id);
+    parser = json_parser_new ();
+
+    // A missing or broken snapshot just means no placeholders.
+    if (!json_parser_load_from_file (parser, path, NULL))
+    {
+        g_free (path);
+        return NULL;
+    }
+
+    g_free (path);
+
+    reader = json_reader_new (json_parser_get_root (parser));
+
+    if (!json_reader_is_object (reader))
+    {
+        return NULL;
+    }
+
+    json_reader_read_member (reader, "version");
+    if (json_reader_get_int_value (reader) != SNAPSHOT_VERSION)
+    {
+        return NULL;
+    }
+    json_reader_end_member (reader);
+
+    if (!json_reader_read_member (reader, "icons") || !json_reader_is_array (reader))
+    {
+        return NULL;
+    }
+
+    n_icons = json_reader_count_elements (reader);
+
+    for (i = 0; i < n_icons; i++)
+    {
+        IconSnapshotEntry *entry;
+
+        json_reader_read_element (reader, i);
+
+        entry = g_slice_new0 (IconSnapshotEntry);
+        entry->key = read_string_member (reader, "key");
+        entry->name = read_string_member (reader, "name");
+        entry->icon_name = read_string_member (reader, "icon-name");
+        entry->label = read_string_member (reader, "label");
+
+        json_reader_end_element (reader);
+
+        if (entry->key == NULL)
+        {
+            icon_snapshot_entry_free (entry);
+            continue;
+        }
+
+        entries = g_list_prepend (entries, entry);
+    }
+
+    json_reader_end_member (reader);
+
+    return g_list_reverse (entries);
+}
+
+static void
+add_string_member (JsonBuilder *builder,
+                   const gchar *member,
+                   const gchar *value)
+{
+    json_builder_set_member_name (builder, member);
+    json_builder_add_string_value (builder, value != NULL ? value : "");
+}
+
+typedef struct
+{
+    gchar *path;
+    gchar *data;
+} SaveJob;
+
+/* Saves waiting for the one being written, in order, so an older snapshot
+ * never replaces a newer one. Main thread only. */
+static GQueue save_queue = G_QUEUE_INIT;
+static gboolean saving = FALSE;
+
+static void
+save_job_free (SaveJob *job)
+{
+    g_free (job->path);
+    g_free (job->data);
+    g_free (job);
+}
+
+static void
+save_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+    SaveJob *job = task_data;
+    GError *error = NULL;
+    gchar *dir;
+
+    dir = g_path_get_dirname (job->path);
+
+    if (g_mkdir_with_parents (dir, 0700) != 0 ||
+        !g_file_set_contents (job->path, job->data, -1, &error))
+    {
+        g_warning ("Could not save the icon snapshot to %s: %s",
+                   job->path, error != NULL ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+    }
+
+    g_free (dir);
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void start_save (void);
+
+static void
+on_snapshot_saved (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+    saving = FALSE;
+
+    start_save ();
+}
+
+static void
+start_save (void)
+{
+    SaveJob *job;
+    GTask *task;
+
+    if (saving || g_queue_is_empty (&save_queue))
+    {
+        return;
+    }
+
+    job = g_queue_pop_head (&save_queue);
+    saving = TRUE;
+
+    task = g_task_new (NULL, NULL, on_snapshot_saved, NULL);
+    g_task_set_task_data (task, job, (GDestroyNotify) save_job_free);
+    g_task_run_in_thread (task, save_thread);
+    g_object_unref (task);
+}
+
+/* Replaces the snapshot with entries, a list of IconSnapshotEntry in
+ * display order. The file is written from a thread, only the JSON is
+ * built here. */
+void
+icon_snapshot_save (gint   plugin_id,
+                    GList *entries)
+{
+    g_autoptr (JsonBuilder) builder = NULL;
+    g_autoptr (JsonGenerator) generator = NULL;
+    g_autoptr (JsonNode) root = NULL;
+    SaveJob *job;
+    GList *l;
+
+    builder = json_builder_new ();
+
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "version");
+    json_builder_add_int_value (builder, SNAPSHOT_VERSION);
+    json_builder_set_member_name (builder, "icons");
+    json_builder_begin_array (builder);
+
+    for (l = entries; l != NULL; l = l->next)
+    {
+        IconSnapshotEntry *entry = l->data;
+
+        json_builder_begin_object (builder);
+        add_string_member (builder, "key", entry->key);
+        add_string_member (builder, "name", entry->name);
+        add_string_member (builder, "icon-name", entry->icon_name);
+        add_string_member (builder, "label", entry->label);
+        json_builder_end_object (builder);
+    }
+
+    json_builder_end_array (builder);
+    json_builder_end_object (builder);
+
+    root = json_builder_get_root (builder);
+    generator = json_generator_new ();
+    json_generator_set_root (generator, root);
+
+    job = g_new0 (SaveJob, 1);
+    job->path = get_snapshot_path (plugin_id);
+    job->data = json_generator_to_data (generator, NULL);
+
+    g_queue_push_tail (&save_queue, job);
+    start_save ();
+}
@@ -0,0 +1,29 @@
+#ifndef _ICON_SNAPSHOT_H_
+#define _ICON_SNAPSHOT_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The icons a plugin instance last showed, saved under the user cache
+ * directory so the next session can show placeholders for them before
+ * the apps are found on the bus. */
+
+typedef struct
+{
+    gchar *key;       /* The plugin's unique key, the app's name and object path */
+    gchar *name;
+    gchar *icon_name;
+    gchar *label;
+} IconSnapshotEntry;
+
+IconSnapshotEntry *icon_snapshot_entry_copy (const IconSnapshotEntry *entry);
+void               icon_snapshot_entry_free (IconSnapshotEntry       *entry);
+
+GList             *icon_snapshot_load       (gint                     plugin_id);
+void               icon_snapshot_save       (gint                     plugin_id,
+                                             GList                   *entries);
+
+G_END_DECLS
+
+#endif /*_ICON_SNAPSHOT_H_ */
@@ -0,0 +1,209 @@
+#include "image-cache.h"
+#include "pixel-cache.h"
+
+#define DEFAULT_MAX_SIZE (4 * 1024 * 1024)
+
+typedef struct
+{
+    gchar   *path;
+    guint64  mtime;
+    guint64  inode;
+    gint     height;
+    gint     scale;
+} ImageCacheKey;
+
+typedef struct
+{
+    ImageCacheKey    key;
+    cairo_surface_t *surface;
+    gsize            size;
+    GList           *link; /* Our element in the lru queue */
+} ImageCacheEntry;
+
+static GHashTable *entries = NULL;
+static GQueue      lru = G_QUEUE_INIT; /* Most recently used first */
+static gsize       total_size = 0;
+static gsize       max_cache_size = DEFAULT_MAX_SIZE;
+
+static guint
+image_cache_key_hash (gconstpointer data)
+{
+    const ImageCacheKey *key = data;
+    guint hash;
+
+    hash = g_str_hash (key->path);
+    hash = hash * 31 + (guint) (key->mtime ^ (key->mtime >> 32));
+    hash = hash * 31 + (guint) (key->inode ^ (key->inode >> 32));
+    hash = hash * 31 + (guint) key->height;
+    hash = hash * 31 + (guint) key->scale;
+
+    return hash;
+}
+
+static gboolean
+image_cache_key_equal (gconstpointer a,
+                       gconstpointer b)
+{
+    const ImageCacheKey *key_a = a;
+    const ImageCacheKey *key_b = b;
+
+    return key_a->mtime == key_b->mtime &&
+           key_a->inode == key_b->inode &&
+           key_a->height == key_b->height &&
+           key_a->scale == key_b->scale &&
+           g_strcmp0 (key_a->path, key_b->path) == 0;
+}
+
+static void
+image_cache_entry_free (ImageCacheEntry *entry)
+{
+    g_free (entry->key.path);
+    cairo_surface_destroy (entry->surface);
+    g_free (entry);
+}
+
+static void
+remove_entry (ImageCacheEntry *entry)
+{
+    g_queue_delete_link (&lru, entry->link);
+    total_size -= entry->size;
+
+    /* Frees the entry */
+    g_hash_table_remove (entries, &entry->key);
+}
+
+static void
+trim_cache (gsize limit)
+{
+    while (total_size > limit && !g_queue_is_empty (&lru))
+    {
+        remove_entry (g_queue_peek_tail (&lru));
+    }
+}
+
+static void
+ensure_entries (void)
+{
+    if (entries != NULL)
+    {
+        return;
+    }
+
+    entries = g_hash_table_new_full (image_cache_key_hash,
+                                     image_cache_key_equal,
+                                     NULL,
+                                     (GDestroyNotify) image_cache_entry_free);
+}
+
+static void
+insert_entry (const gchar     *path,
+              guint64          mtime,
+              guint64          inode,
+              gint             height,
+              gint             scale,
+              cairo_surface_t *surface)
+{
+    ImageCacheKey key = { (gchar *) path, mtime, inode, height, scale };
+    ImageCacheEntry *entry;
+    gsize size;
+
+    // We can only account for the memory of image surfaces.
+    if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE)
+    {
+        return;
+    }
+
+    size = (gsize) cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+
+    if (size > max_cache_size)
+    {
+        return;
+    }
+
+    ensure_entries ();
+
+    entry = g_hash_table_lookup (entries, &key);
+
+    if (entry != NULL)
+    {
+        remove_entry (entry);
+    }
+
+    trim_cache (max_cache_size - size);
+
+    entry = g_new0 (ImageCacheEntry, 1);
+    entry->key.path = g_strdup (path);
+    entry->key.mtime = mtime;
+    entry->key.inode = inode;
+    entry->key.height = height;
+    entry->key.scale = scale;
+    entry->surface = cairo_surface_reference (surface);
+    entry->size = size;
+
+    g_queue_push_head (&lru, entry);
+    entry->link = g_queue_peek_head_link (&lru);
+    total_size += size;
+
+    g_hash_table_insert (entries, &entry->key, entry);
+}
+
+void
+image_cache_set_max_size (gsize max_size)
+{
+    max_cache_size = max_size;
+
+    if (entries != NULL)
+    {
+        trim_cache (max_cache_size);
+    }
+}
+
+cairo_surface_t *
+image_cache_lookup (const gchar *path,
+                    guint64      mtime,
+                    guint64      inode,
+                    gint         height,
+                    gint         scale)
+{
+    ImageCacheKey key = { (gchar *) path, mtime, inode, height, scale };
+    ImageCacheEntry *entry;
+
+    g_return_val_if_fail (path != NULL, NULL);
+
+    entry = entries != NULL ? g_hash_table_lookup (entries, &key) : NULL;
+
+    if (entry == NULL)
+    {
+        cairo_surface_t *surface;
+
+        // Decoded by an earlier session, or by another panel process.
+        surface = pixel_cache_lookup (path, mtime, inode, height, scale);
+
+        if (surface != NULL)
+        {
+            insert_entry (path, mtime, inode, height, scale, surface);
+        }
+
+        return surface;
+    }
+
+    g_queue_unlink (&lru, entry->link);
+    g_queue_push_head_link (&lru, entry->link);
+
+    return cairo_surface_reference (entry->surface);
+}
+
+void
+image_cache_insert (const gchar     *path,
+                    guint64          mtime,
+                    guint64          inode,
+                    gint             height,
+                    gint             scale,
+                    cairo_surface_t *surface)
+{
+    g_return_if_fail (path != NULL);
+    g_return_if_fail (surface != NULL);
+
+    insert_entry (path, mtime, inode, height, scale, surface);
+    pixel_cache_store (path, mtime, inode, height, scale, surface);
+}
@@ -0,0 +1,36 @@
+#ifndef _IMAGE_CACHE_H_
+#define _IMAGE_CACHE_H_
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+/* A process-wide cache of decoded file-based icons, shared by every
+ * StatusIcon. Entries are keyed by the file and its modification time,
+ * the requested height and the scale factor, and the least recently used
+ * ones are evicted once the cache grows past its size limit.
+ *
+ * Lookups that miss in memory fall back to the on-disk pixel cache, and
+ * inserted surfaces are also handed to it, see pixel-cache.h.
+ *
+ * The cache is not thread-safe, it must only be used from the main thread. */
+
+void             image_cache_set_max_size (gsize            max_size);
+
+cairo_surface_t *image_cache_lookup       (const gchar     *path,
+                                           guint64          mtime,
+                                           guint64          inode,
+                                           gint             height,
+                                           gint             scale);
+
+void             image_cache_insert       (const gchar     *path,
+                                           guint64          mtime,
+                                           guint64          inode,
+                                           gint             height,
+                                           gint             scale,
+                                           cairo_surface_t *surface);
+
+G_END_DECLS
+
+#endif /*_IMAGE_CACHE_H_ */
@@ -0,0 +1,674 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "pixel-cache.h"
+
+#define CACHE_MAGIC       "XSPC"
+#define CACHE_VERSION     1
+#define CACHE_MAX_SIZE    (16 * 1024 * 1024)
+#define WRITE_DELAY       10 /* Seconds to collect new surfaces before writing them */
+#define PIXELS_ALIGNMENT  16
+
+/* The file starts with a header, then the records and the paths they point
+ * to (the index), and then the pixels of each record, aligned. Everything is
+ * in host byte order, the file is only meant for this machine. */
+typedef struct
+{
+    gchar   magic[4];
+    guint32 version;
+    guint32 n_records;
+    guint32 index_checksum;
+    guint64 index_size;
+    guint64 file_size;
+} CacheHeader;
+
+typedef struct
+{
+    guint64 mtime;
+    guint64 inode;
+    guint64 pixels_offset;
+    guint32 path_offset;
+    guint32 path_length;
+    gint32  height; /* The requested height, part of the key */
+    gint32  scale;
+    gint32  width;  /* Of the surface, in device pixels */
+    gint32  pixels_height;
+    gint32  stride;
+    guint32 pixels_checksum;
+} CacheRecord;
+
+/* A surface waiting to be written */
+typedef struct
+{
+    CacheRecord  record; /* Offsets unset */
+    gchar       *path;
+    GBytes      *pixels;
+} PendingSurface;
+
+typedef struct
+{
+    GMappedFile *old_file; /* May be NULL */
+    GList       *pending;  /* Newest first */
+} WriteJob;
+
+/* A mapping checked by the loading thread */
+typedef struct
+{
+    GMappedFile *file;
+    GHashTable  *records;
+} LoadResult;
+
+static GMappedFile  *mapped_file = NULL;
+static GHashTable   *records = NULL; /* Lookup key -> const CacheRecord * in mapped_file */
+static GFileMonitor *monitor = NULL; /* May stay NULL, we still see our own writes */
+static gboolean      started = FALSE;
+static gboolean      loading = FALSE;
+static gboolean      reload_queued = FALSE;
+
+static GList       *pending = NULL; /* Newest first */
+static GHashTable  *pending_keys = NULL;
+static guint        write_id = 0;
+static gboolean     writing = FALSE;
+
+static const cairo_user_data_key_t mapping_key;
+
+static gchar *
+get_cache_path (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "xfce4-xapp-status-plugin", "pixels.cache", NULL);
+}
+
+static gchar *
+make_key (const gchar *path,
+          gsize        path_length,
+          guint64      mtime,
+          guint64      inode,
+          gint         height,
+          gint         scale)
+{
+    return g_strdup_printf ("%.*s|%" G_GUINT64_FORMAT "|%" G_GUINT64_FORMAT "|%d|%d",
+                            (gint) path_length, path, mtime, inode, height, scale);
+}
+
+/* FNV-1a, enough to catch a truncated or scribbled file */
+static guint32
+checksum (const guint8 *data,
+          gsize         length)
+{
+    guint32 hash = 2166136261u;
+
+    while (length-- > 0)
+    {
+        hash ^= *data++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static gboolean
+record_is_valid (const CacheRecord *record,
+                 const CacheHeader *header)
+{
+    guint64 index_start = sizeof (CacheHeader) + (guint64) header->n_records * sizeof (CacheRecord);
+    guint64 index_end = sizeof (CacheHeader) + header->index_size;
+
+    return record->path_offset >= index_start &&
+           (guint64) record->path_offset + record->path_length <= index_end &&
+           record->width > 0 &&
+           record->pixels_height > 0 &&
+           record->stride >= (gint64) record->width * 4 &&
+           record->pixels_offset % PIXELS_ALIGNMENT == 0 &&
+           record->pixels_offset >= index_end &&
+           record->pixels_offset <= header->file_size &&
+           record->pixels_offset + (guint64) record->stride * record->pixels_height <= header->file_size;
+}
+
+/* Checks everything, pixels included, so lookups can trust the mapping */
+static gboolean
+validate_file (GMappedFile *file)
+{
+    const gchar *data = g_mapped_file_get_contents (file);
+    gsize length = g_mapped_file_get_length (file);
+    const CacheHeader *header = (const CacheHeader *) data;
+    const CacheRecord *file_records;
+    guint i;
+
+    if (length < sizeof (CacheHeader) ||
+        memcmp (header->magic, CACHE_MAGIC, 4) != 0 ||
+        header->version != CACHE_VERSION ||
+        header->file_size != length ||
+        header->index_size > length - sizeof (CacheHeader) ||
+        header->n_records > header->index_size / sizeof (CacheRecord))
+    {
+        return FALSE;
+    }
+
+    if (checksum ((const guint8 *) data + sizeof (CacheHeader), header->index_size) != header->index_checksum)
+    {
+        return FALSE;
+    }
+
+    file_records = (const CacheRecord *) (data + sizeof (CacheHeader));
+
+    for (i = 0; i < header->n_records; i++)
+    {
+        const CacheRecord *record = &file_records[i];
+
+        if (!record_is_valid (record, header) ||
+            checksum ((const guint8 *) data + record->pixels_offset,
+                      (gsize) record->stride * record->pixels_height) != record->pixels_checksum)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+load_result_free (LoadResult *result)
+{
+    g_mapped_file_unref (result->file);
+    g_hash_table_unref (result->records);
+    g_free (result);
+}
+
+static void
+load_cache_thread (GTask        *task,
+                   gpointer      source_object,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+    const gchar *data;
+    const CacheHeader *header;
+    const CacheRecord *file_records;
+    LoadResult *result;
+    GMappedFile *file;
+    gchar *path;
+    guint i;
+
+    path = get_cache_path ();
+    file = g_mapped_file_new (path, FALSE, NULL);
+    g_free (path);
+
+    // A missing, corrupt or outdated file is ignored, the next write replaces it.
+    if (file == NULL || !validate_file (file))
+    {
+        g_clear_pointer (&file, g_mapped_file_unref);
+        g_task_return_pointer (task, NULL, NULL);
+        return;
+    }
+
+    result = g_new0 (LoadResult, 1);
+    result->file = file;
+    result->records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    data = g_mapped_file_get_contents (file);
+    header = (const CacheHeader *) data;
+    file_records = (const CacheRecord *) (data + sizeof (CacheHeader));
+
+    for (i = 0; i < header->n_records; i++)
+    {
+        const CacheRecord *record = &file_records[i];
+
+        g_hash_table_insert (result->records,
+                             make_key (data + record->path_offset, record->path_length,
+                                       record->mtime, record->inode, record->height, record->scale),
+                             (gpointer) record);
+    }
+
+    g_task_return_pointer (task, result, (GDestroyNotify) load_result_free);
+}
+
+static void start_load (void);
+
+static void
+on_cache_loaded (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+    LoadResult *loaded;
+
+    loading = FALSE;
+
+    loaded = g_task_propagate_pointer (G_TASK (result), NULL);
+
+    // Surfaces handed out earlier keep the old mapping alive on their own.
+    g_clear_pointer (&records, g_hash_table_unref);
+    g_clear_pointer (&mapped_file, g_mapped_file_unref);
+
+    if (loaded != NULL)
+    {
+        mapped_file = loaded->file;
+        records = loaded->records;
+        g_free (loaded);
+    }
+
+    // The file was replaced again while we were checking it.
+    if (reload_queued)
+    {
+        start_load ();
+    }
+}
+
+/* Maps and checks the file from a thread, then swaps it in */
+static void
+start_load (void)
+{
+    GTask *task;
+
+    if (loading)
+    {
+        reload_queued = TRUE;
+        return;
+    }
+
+    loading = TRUE;
+    reload_queued = FALSE;
+
+    task = g_task_new (NULL, NULL, on_cache_loaded, NULL);
+    g_task_run_in_thread (task, load_cache_thread);
+    g_object_unref (task);
+}
+
+static void
+on_cache_file_changed (GFileMonitor      *file_monitor,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event_type,
+                       gpointer           user_data)
+{
+    // Writers rename a complete file over the old one, any event but these means a new file.
+    if (event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED ||
+        event_type == G_FILE_MONITOR_EVENT_PRE_UNMOUNT ||
+        event_type == G_FILE_MONITOR_EVENT_UNMOUNTED)
+    {
+        return;
+    }
+
+    start_load ();
+}
+
+/* Starts mapping the cache file, and watches for other processes replacing
+ * it. Lookups miss until the first mapping is ready, so call this early. */
+void
+pixel_cache_load (void)
+{
+    GFile *file;
+    gchar *path;
+
+    if (started)
+    {
+        return;
+    }
+
+    started = TRUE;
+
+    path = get_cache_path ();
+    file = g_file_new_for_path (path);
+    g_free (path);
+
+    monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+    g_object_unref (file);
+
+    if (monitor != NULL)
+    {
+        g_signal_connect (monitor, "changed", G_CALLBACK (on_cache_file_changed), NULL);
+    }
+
+    start_load ();
+}
+
+static const CacheRecord *
+find_record (const gchar *key)
+{
+    if (records == NULL)
+    {
+        return NULL;
+    }
+
+    return g_hash_table_lookup (records, key);
+}
+
+cairo_surface_t *
+pixel_cache_lookup (const gchar *path,
+                    guint64      mtime,
+                    guint64      inode,
+                    gint         height,
+                    gint         scale)
+{
+    const CacheRecord *record;
+    const guint8 *pixels;
+    cairo_surface_t *surface;
+    gchar *key;
+
+    g_return_val_if_fail (path != NULL, NULL);
+
+    pixel_cache_load ();
+
+    // No I/O and no checksum here, the loading thread checked the whole mapping.
+    key = make_key (path, strlen (path), mtime, inode, height, scale);
+    record = find_record (key);
+    g_free (key);
+
+    if (record == NULL)
+    {
+        return NULL;
+    }
+
+    pixels = (const guint8 *) g_mapped_file_get_contents (mapped_file) + record->pixels_offset;
+
+    // The mapping is read-only, nothing ever draws into these surfaces.
+    surface = cairo_image_surface_create_for_data ((guchar *) pixels,
+                                                   CAIRO_FORMAT_ARGB32,
+                                                   record->width,
+                                                   record->pixels_height,
+                                                   record->stride);
+
+    cairo_surface_set_user_data (surface,
+                                 &mapping_key,
+                                 g_mapped_file_ref (mapped_file),
+                                 (cairo_destroy_func_t) g_mapped_file_unref);
+    cairo_surface_set_device_scale (surface, scale, scale);
+
+    return surface;
+}
+
+static void
+pending_surface_free (PendingSurface *surface)
+{
+    g_free (surface->path);
+    g_bytes_unref (surface->pixels);
+    g_free (surface);
+}
+
+static void
+write_job_free (WriteJob *job)
+{
+    g_clear_pointer (&job->old_file, g_mapped_file_unref);
+    g_list_free_full (job->pending, (GDestroyNotify) pending_surface_free);
+    g_free (job);
+}
+
+/* Source file unchanged since the record was made */
+static gboolean
+source_is_current (const gchar       *path,
+                   const CacheRecord *record)
+{
+    GStatBuf st;
+
+    return g_stat (path, &st) == 0 &&
+           (guint64) st.st_mtime == record->mtime &&
+           (guint64) st.st_ino == record->inode;
+}
+
+static void
+write_cache_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+    WriteJob *job = task_data;
+    GArray *new_records;
+    GPtrArray *sources; /* Pixels of each new record */
+    GString *paths;
+    GHashTable *keys;
+    GByteArray *contents;
+    CacheHeader header = { { 0 } };
+    guint64 total = 0, offset;
+    GList *l;
+    gchar *path, *dir;
+    guint i;
+
+    new_records = g_array_new (FALSE, FALSE, sizeof (CacheRecord));
+    sources = g_ptr_array_new ();
+    paths = g_string_new (NULL);
+    keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    // The new surfaces first, then the old ones in their order: most recent first.
+    for (l = job->pending; l != NULL; l = l->next)
+    {
+        PendingSurface *surface = l->data;
+        CacheRecord record = surface->record;
+        gsize size = g_bytes_get_size (surface->pixels);
+
+        if (total + size > CACHE_MAX_SIZE)
+        {
+            continue;
+        }
+
+        g_hash_table_add (keys, make_key (surface->path, strlen (surface->path),
+                                          record.mtime, record.inode, record.height, record.scale));
+
+        record.path_offset = paths->len;
+        record.path_length = strlen (surface->path);
+        g_string_append_len (paths, surface->path, record.path_length);
+
+        g_array_append_val (new_records, record);
+        g_ptr_array_add (sources, (gpointer) g_bytes_get_data (surface->pixels, NULL));
+        total += size;
+    }
+
+    if (job->old_file != NULL)
+    {
+        const gchar *data = g_mapped_file_get_contents (job->old_file);
+        const CacheHeader *old_header = (const CacheHeader *) data;
+        const CacheRecord *old_records = (const CacheRecord *) (data + sizeof (CacheHeader));
+
+        for (i = 0; i < old_header->n_records; i++)
+        {
+            CacheRecord record = old_records[i];
+            gsize size = (gsize) record.stride * record.pixels_height;
+            gchar *record_path, *key;
+
+            if (total + size > CACHE_MAX_SIZE)
+            {
+                continue;
+            }
+
+            record_path = g_strndup (data + record.path_offset, record.path_length);
+            key = make_key (record_path, record.path_length,
+                            record.mtime, record.inode, record.height, record.scale);
+
+            if (g_hash_table_contains (keys, key) || !source_is_current (record_path, &record))
+            {
+                g_free (record_path);
+                g_free (key);
+                continue;
+            }
+
+            g_hash_table_add (keys, key);
+
+            record.path_offset = paths->len;
+            g_string_append_len (paths, record_path, record.path_length);
+            g_free (record_path);
+
+            g_array_append_val (new_records, record);
+            g_ptr_array_add (sources, (gpointer) (data + old_records[i].pixels_offset));
+            total += size;
+        }
+    }
+
+    // Lay the file out: header, records, paths, then the aligned pixels.
+    memcpy (header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.n_records = new_records->len;
+    header.index_size = (guint64) new_records->len * sizeof (CacheRecord) + paths->len;
+
+    offset = sizeof (CacheHeader) + header.index_size;
+
+    for (i = 0; i < new_records->len; i++)
+    {
+        CacheRecord *record = &g_array_index (new_records, CacheRecord, i);
+
+        offset = (offset + PIXELS_ALIGNMENT - 1) / PIXELS_ALIGNMENT * PIXELS_ALIGNMENT;
+
+        record->path_offset += sizeof (CacheHeader) + new_records->len * sizeof (CacheRecord);
+        record->pixels_offset = offset;
+        offset += (guint64) record->stride * record->pixels_height;
+    }
+
+    header.file_size = offset;
+
+    contents = g_byte_array_sized_new (offset);
+    g_byte_array_set_size (contents, offset);
+    memset (contents->data, 0, offset);
+
+    memcpy (contents->data + sizeof (CacheHeader), new_records->data, new_records->len * sizeof (CacheRecord));
+    memcpy (contents->data + sizeof (CacheHeader) + new_records->len * sizeof (CacheRecord), paths->str, paths->len);
+
+    for (i = 0; i < new_records->len; i++)
+    {
+        const CacheRecord *record = &g_array_index (new_records, CacheRecord, i);
+
+        memcpy (contents->data + record->pixels_offset,
+                g_ptr_array_index (sources, i),
+                (gsize) record->stride * record->pixels_height);
+    }
+
+    header.index_checksum = checksum (contents->data + sizeof (CacheHeader), header.index_size);
+    memcpy (contents->data, &header, sizeof (CacheHeader));
+
+    // Written to a temporary file and renamed over, so processes that still
+    // map the old file keep reading consistent data.
+    path = get_cache_path ();
+    dir = g_path_get_dirname (path);
+
+    if (g_mkdir_with_parents (dir, 0700) == 0)
+    {
+        GError *error = NULL;
+
+        if (!g_file_set_contents (path, (const gchar *) contents->data, contents->len, &error))
+        {
+            g_warning ("Could not write the pixel cache: %s", error->message);
+            g_error_free (error);
+        }
+    }
+
+    g_free (dir);
+    g_free (path);
+    g_byte_array_unref (contents);
+    g_hash_table_unref (keys);
+    g_string_free (paths, TRUE);
+    g_ptr_array_unref (sources);
+    g_array_unref (new_records);
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void queue_write (void);
+
+static void
+on_cache_written (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+    writing = FALSE;
+
+    // Map our own file, the monitor may be missing or late, and write what came in meanwhile.
+    start_load ();
+
+    if (pending != NULL)
+    {
+        queue_write ();
+    }
+}
+
+static gboolean
+write_cache_cb (gpointer user_data)
+{
+    WriteJob *job;
+    GTask *task;
+
+    write_id = 0;
+    writing = TRUE;
+
+    job = g_new0 (WriteJob, 1);
+    job->old_file = mapped_file != NULL ? g_mapped_file_ref (mapped_file) : NULL;
+    job->pending = pending;
+
+    pending = NULL;
+    g_hash_table_remove_all (pending_keys);
+
+    task = g_task_new (NULL, NULL, on_cache_written, NULL);
+    g_task_set_task_data (task, job, (GDestroyNotify) write_job_free);
+    g_task_run_in_thread (task, write_cache_thread);
+    g_object_unref (task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+queue_write (void)
+{
+    if (write_id > 0 || writing)
+    {
+        return;
+    }
+
+    write_id = g_timeout_add_seconds (WRITE_DELAY, write_cache_cb, NULL);
+}
+
+void
+pixel_cache_store (const gchar     *path,
+                   guint64          mtime,
+                   guint64          inode,
+                   gint             height,
+                   gint             scale,
+                   cairo_surface_t *surface)
+{
+    PendingSurface *pending_surface;
+    gchar *key;
+    gint stride, surface_height;
+
+    g_return_if_fail (path != NULL);
+    g_return_if_fail (surface != NULL);
+
+    if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+        cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32)
+    {
+        return;
+    }
+
+    // The writer keeps what the current file holds, it has to be mapped.
+    pixel_cache_load ();
+
+    if (pending_keys == NULL)
+    {
+        pending_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    key = make_key (path, strlen (path), mtime, inode, height, scale);
+
+    if (find_record (key) != NULL || g_hash_table_contains (pending_keys, key))
+    {
+        g_free (key);
+        return;
+    }
+
+    g_hash_table_add (pending_keys, key);
+
+    cairo_surface_flush (surface);
+
+    stride = cairo_image_surface_get_stride (surface);
+    surface_height = cairo_image_surface_get_height (surface);
+
+    pending_surface = g_new0 (PendingSurface, 1);
+    pending_surface->path = g_strdup (path);
+    pending_surface->pixels = g_bytes_new (cairo_image_surface_get_data (surface), (gsize) stride * surface_height);
+    pending_surface->record.mtime = mtime;
+    pending_surface->record.inode = inode;
+    pending_surface->record.height = height;
+    pending_surface->record.scale = scale;
+    pending_surface->record.width = cairo_image_surface_get_width (surface);
+    pending_surface->record.pixels_height = surface_height;
+    pending_surface->record.stride = stride;
+    pending_surface->record.pixels_checksum = checksum (g_bytes_get_data (pending_surface->pixels, NULL),
+                                                        (gsize) stride * surface_height);
+
+    pending = g_list_prepend (pending, pending_surface);
+
+    queue_write ();
+}
@@ -0,0 +1,44 @@
+#ifndef _PIXEL_CACHE_H_
+#define _PIXEL_CACHE_H_
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+/* Decoded file-based icons kept on disk between sessions, in a single file
+ * under the user cache directory that every panel process maps read-only.
+ * Surfaces returned by a lookup point straight into the mapping, so a hit
+ * costs neither a decode nor a copy, and the processes share the pages.
+ *
+ * The file is mapped and fully checked, pixels included, from a thread,
+ * and mapped again whenever it is replaced, so lookups do no I/O. Lookups
+ * miss until the first mapping is ready.
+ *
+ * Stored surfaces are written out from a thread a little later, together
+ * with the still valid entries of the current file, most recent first, up
+ * to a size limit. Entries whose source file changed are dropped then.
+ *
+ * Only file-based icons the plugin decodes itself are cached. Themed icons
+ * are loaded by GTK, and are still decoded in every session.
+ *
+ * Only used from the main thread, as the L2 of the image cache. */
+
+void             pixel_cache_load   (void);
+
+cairo_surface_t *pixel_cache_lookup (const gchar     *path,
+                                     guint64          mtime,
+                                     guint64          inode,
+                                     gint             height,
+                                     gint             scale);
+
+void             pixel_cache_store  (const gchar     *path,
+                                     guint64          mtime,
+                                     guint64          inode,
+                                     gint             height,
+                                     gint             scale,
+                                     cairo_surface_t *surface);
+
+G_END_DECLS
+
+#endif /*_PIXEL_CACHE_H_ */
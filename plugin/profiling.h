@@ -0,0 +1,25 @@
+#ifndef _PROFILING_H_
+#define _PROFILING_H_
+
+#include <glib.h>
+
+/* Sysprof marks around the plugin's hot paths, so they can be lined up
+ * against GTK's frame timings in a capture. Only built with -Dsysprof=true,
+ * otherwise these expand to nothing. */
+
+#ifdef HAVE_SYSPROF
+
+#include <sysprof-capture.h>
+
+#define PROFILE_BEGIN(var)              gint64 var = SYSPROF_CAPTURE_CURRENT_TIME
+#define PROFILE_END(var, name, message) sysprof_collector_mark (var, SYSPROF_CAPTURE_CURRENT_TIME - var, \
+                                                                "xapp-status-plugin", name, message)
+
+#else
+
+#define PROFILE_BEGIN(var)
+#define PROFILE_END(var, name, message)
+
+#endif
+
+#endif /*_PROFILING_H_ */
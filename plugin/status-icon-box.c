@@ -0,0 +1,303 @@
+#include "status-icon-box.h"
+#include "status-icon.h"
+
+struct _StatusIconBox
+{
+    GtkContainer parent_instance;
+
+    GList *children; /* In display order */
+
+    GtkOrientation orientation;
+    gint slot_size;
+};
+
+G_DEFINE_TYPE (StatusIconBox, status_icon_box, GTK_TYPE_CONTAINER)
+
+/* Sizes a child along the box's orientation (main) and across it (cross) */
+static void
+get_child_size (StatusIconBox *box,
+                GtkWidget     *child,
+                gint          *main_size,
+                gint          *cross_size)
+{
+    gint min_width, nat_width, min_height, nat_height;
+    gboolean uniform;
+
+    // GTK caches these requests, so asking again for unchanged icons is cheap.
+    gtk_widget_get_preferred_width (child, &min_width, &nat_width);
+    gtk_widget_get_preferred_height (child, &min_height, &nat_height);
+
+    uniform = !STATUS_IS_ICON (child) || !status_icon_has_label (STATUS_ICON (child));
+
+    if (box->orientation == GTK_ORIENTATION_HORIZONTAL)
+    {
+        *main_size = MAX (box->slot_size, uniform ? min_width : nat_width);
+        *cross_size = MAX (box->slot_size, min_height);
+    }
+    else
+    {
+        *main_size = MAX (box->slot_size, uniform ? min_height : nat_height);
+        *cross_size = MAX (box->slot_size, min_width);
+    }
+}
+
+static void
+status_icon_box_measure (StatusIconBox  *box,
+                         GtkOrientation  orientation,
+                         gint           *minimum,
+                         gint           *natural)
+{
+    GList *l;
+    gint main_total = 0, cross_max = 0;
+    gint border = gtk_container_get_border_width (GTK_CONTAINER (box));
+
+    for (l = box->children; l != NULL; l = l->next)
+    {
+        gint main_size, cross_size;
+
+        if (!gtk_widget_get_visible (l->data))
+        {
+            continue;
+        }
+
+        get_child_size (box, l->data, &main_size, &cross_size);
+
+        main_total += main_size;
+        cross_max = MAX (cross_max, cross_size);
+    }
+
+    *minimum = *natural = (orientation == box->orientation ? main_total : cross_max) + 2 * border;
+}
+
+static void
+status_icon_box_get_preferred_width (GtkWidget *widget,
+                                     gint      *minimum,
+                                     gint      *natural)
+{
+    status_icon_box_measure (STATUS_ICON_BOX (widget), GTK_ORIENTATION_HORIZONTAL, minimum, natural);
+}
+
+static void
+status_icon_box_get_preferred_height (GtkWidget *widget,
+                                      gint      *minimum,
+                                      gint      *natural)
+{
+    status_icon_box_measure (STATUS_ICON_BOX (widget), GTK_ORIENTATION_VERTICAL, minimum, natural);
+}
+
+static void
+status_icon_box_size_allocate (GtkWidget     *widget,
+                               GtkAllocation *allocation)
+{
+    StatusIconBox *box = STATUS_ICON_BOX (widget);
+    GList *l;
+    gint border = gtk_container_get_border_width (GTK_CONTAINER (box));
+    gboolean rtl = gtk_widget_get_direction (widget) == GTK_TEXT_DIR_RTL;
+    gint offset = 0;
+
+    gtk_widget_set_allocation (widget, allocation);
+
+    // One pass in display order, each icon starts where the previous one ended.
+    for (l = box->children; l != NULL; l = l->next)
+    {
+        GtkWidget *child = l->data;
+        GtkAllocation child_allocation;
+        gint main_size, cross_size;
+
+        if (!gtk_widget_get_visible (child))
+        {
+            continue;
+        }
+
+        get_child_size (box, child, &main_size, &cross_size);
+
+        if (box->orientation == GTK_ORIENTATION_HORIZONTAL)
+        {
+            child_allocation.x = rtl ? allocation->x + allocation->width - border - offset - main_size
+                                     : allocation->x + border + offset;
+            child_allocation.y = allocation->y + border;
+            child_allocation.width = main_size;
+            child_allocation.height = MAX (allocation->height - 2 * border, 1);
+        }
+        else
+        {
+            child_allocation.x = allocation->x + border;
+            child_allocation.y = allocation->y + border + offset;
+            child_allocation.width = MAX (allocation->width - 2 * border, 1);
+            child_allocation.height = main_size;
+        }
+
+        offset += main_size;
+
+        gtk_widget_size_allocate (child, &child_allocation);
+    }
+}
+
+static void
+status_icon_box_add (GtkContainer *container,
+                     GtkWidget    *child)
+{
+    StatusIconBox *box = STATUS_ICON_BOX (container);
+
+    box->children = g_list_append (box->children, child);
+    gtk_widget_set_parent (child, GTK_WIDGET (box));
+}
+
+static void
+status_icon_box_remove (GtkContainer *container,
+                        GtkWidget    *child)
+{
+    StatusIconBox *box = STATUS_ICON_BOX (container);
+    GList *link;
+    gboolean was_visible;
+
+    link = g_list_find (box->children, child);
+
+    if (link == NULL)
+    {
+        return;
+    }
+
+    was_visible = gtk_widget_get_visible (child);
+
+    gtk_widget_unparent (child);
+    box->children = g_list_delete_link (box->children, link);
+
+    if (was_visible)
+    {
+        gtk_widget_queue_resize (GTK_WIDGET (box));
+    }
+}
+
+static void
+status_icon_box_forall (GtkContainer *container,
+                        gboolean      include_internals,
+                        GtkCallback   callback,
+                        gpointer      callback_data)
+{
+    StatusIconBox *box = STATUS_ICON_BOX (container);
+    GList *l = box->children;
+
+    // The callback may remove the child, e.g. when destroying.
+    while (l != NULL)
+    {
+        GtkWidget *child = l->data;
+
+        l = l->next;
+        callback (child, callback_data);
+    }
+}
+
+static GType
+status_icon_box_child_type (GtkContainer *container)
+{
+    return GTK_TYPE_WIDGET;
+}
+
+static void
+status_icon_box_init (StatusIconBox *box)
+{
+    gtk_widget_set_has_window (GTK_WIDGET (box), FALSE);
+
+    box->orientation = GTK_ORIENTATION_HORIZONTAL;
+}
+
+static void
+status_icon_box_class_init (StatusIconBoxClass *klass)
+{
+    GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+    GtkContainerClass *container_class = GTK_CONTAINER_CLASS (klass);
+
+    widget_class->get_preferred_width = status_icon_box_get_preferred_width;
+    widget_class->get_preferred_height = status_icon_box_get_preferred_height;
+    widget_class->size_allocate = status_icon_box_size_allocate;
+
+    container_class->add = status_icon_box_add;
+    container_class->remove = status_icon_box_remove;
+    container_class->forall = status_icon_box_forall;
+    container_class->child_type = status_icon_box_child_type;
+}
+
+void
+status_icon_box_set_orientation (StatusIconBox  *box,
+                                 GtkOrientation  orientation)
+{
+    g_return_if_fail (STATUS_IS_ICON_BOX (box));
+
+    if (box->orientation == orientation)
+    {
+        return;
+    }
+
+    box->orientation = orientation;
+    gtk_widget_queue_resize (GTK_WIDGET (box));
+}
+
+/* The size of the square each icon gets, replacing a size request per icon */
+void
+status_icon_box_set_slot_size (StatusIconBox *box,
+                               gint           slot_size)
+{
+    g_return_if_fail (STATUS_IS_ICON_BOX (box));
+
+    if (box->slot_size == slot_size)
+    {
+        return;
+    }
+
+    box->slot_size = slot_size;
+    gtk_widget_queue_resize (GTK_WIDGET (box));
+}
+
+/* Moves child to position, does nothing when it is already there */
+void
+status_icon_box_reorder (StatusIconBox *box,
+                         GtkWidget     *child,
+                         gint           position)
+{
+    GList *link;
+
+    g_return_if_fail (STATUS_IS_ICON_BOX (box));
+
+    link = g_list_find (box->children, child);
+
+    g_return_if_fail (link != NULL);
+
+    if (g_list_position (box->children, link) == position)
+    {
+        return;
+    }
+
+    box->children = g_list_delete_link (box->children, link);
+    box->children = g_list_insert (box->children, child, position);
+
+    // Hidden icons take no room, moving them changes nothing on screen.
+    if (gtk_widget_get_visible (child))
+    {
+        gtk_widget_queue_resize (GTK_WIDGET (box));
+    }
+}
+
+/* The room child takes along the box, whether it is in this box or not */
+gint
+status_icon_box_get_child_length (StatusIconBox *box,
+                                  GtkWidget     *child)
+{
+    gint main_size, cross_size;
+
+    g_return_val_if_fail (STATUS_IS_ICON_BOX (box), 0);
+
+    get_child_size (box, child, &main_size, &cross_size);
+
+    return main_size;
+}
+
+GtkWidget *
+status_icon_box_new (GtkOrientation orientation)
+{
+    StatusIconBox *box = g_object_new (STATUS_TYPE_ICON_BOX, NULL);
+
+    box->orientation = orientation;
+
+    return GTK_WIDGET (box);
+}
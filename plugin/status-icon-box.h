@@ -0,0 +1,31 @@
+#ifndef _STATUS_ICON_BOX_H_
+#define _STATUS_ICON_BOX_H_
+
+#include <glib-object.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define STATUS_TYPE_ICON_BOX (status_icon_box_get_type ())
+
+G_DECLARE_FINAL_TYPE (StatusIconBox, status_icon_box, STATUS, ICON_BOX, GtkContainer)
+
+/* Lays out status icons in a single line, in the order they were inserted.
+ * Icons without a label share a fixed square slot, only labelled ones are
+ * measured for their natural length. */
+
+GtkWidget *status_icon_box_new             (GtkOrientation  orientation);
+
+void       status_icon_box_set_orientation (StatusIconBox  *box,
+                                            GtkOrientation  orientation);
+void       status_icon_box_set_slot_size   (StatusIconBox  *box,
+                                            gint            slot_size);
+void       status_icon_box_reorder         (StatusIconBox  *box,
+                                            GtkWidget      *child,
+                                            gint            position);
+gint       status_icon_box_get_child_length (StatusIconBox *box,
+                                             GtkWidget     *child);
+
+G_END_DECLS
+
+#endif /*_STATUS_ICON_BOX_H_ */
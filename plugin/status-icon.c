@@ -3,15 +3,63 @@
 #include <json-glib/json-glib.h>
 
 #include "status-icon.h"
+#include "image-cache.h"
+#include "decode-pool.h"
+#include "icon-animation.h"
+#include "profiling.h"
 #include <libxapp/xapp-status-icon.h>
 
-enum
+/* Shared by every icon, so the css is only parsed once */
+static GtkCssProvider *icon_css_provider = NULL;
+
+typedef struct {
+  gchar   *path;
+  guint64  mtime, inode;
+  gint     height, scale;
+} FileImageRequest;
+
+/* The last known mtime and inode of a file-based icon. An update to a file
+ * seen before is applied from them right away, its query only confirms them. */
+typedef struct {
+  guint64  mtime, inode;
+} FileStamp;
+
+#define MAX_FILE_STAMPS 256
+
+/* Shared by every icon, path -> FileStamp */
+static GHashTable *file_stamps = NULL;
+
+/* Proxy properties changed since the last frame */
+typedef enum
+{
+    CHANGED_ICON_NAME = 1 << 0,
+    CHANGED_LABEL     = 1 << 1,
+    CHANGED_TOOLTIP   = 1 << 2,
+    CHANGED_VISIBLE   = 1 << 3,
+    CHANGED_METADATA  = 1 << 4,
+} PropertyChanges;
+
+static const struct
 {
-    RE_SORT,
-    LAST_SIGNAL
+    const gchar     *name;
+    PropertyChanges  change;
+} property_changes[] =
+{
+    { "IconName",    CHANGED_ICON_NAME },
+    { "Label",       CHANGED_LABEL },
+    { "TooltipText", CHANGED_TOOLTIP },
+    { "Visible",     CHANGED_VISIBLE },
+    { "Metadata",    CHANGED_METADATA },
 };
 
-static guint signals[LAST_SIGNAL] = {0, };
+/* Hints an app can give in its metadata json */
+typedef struct {
+  gboolean   highlight_both_menus;
+  gchar    **animation_frames;
+  gint       animation_interval;
+  gboolean   stable_label;
+  gchar     *label_template;
+} StatusIconMetadata;
 
 struct _StatusIcon
 {
@@ -26,138 +74,468 @@ struct _StatusIcon
 
     XAppStatusIconInterface *proxy; /* The proxy for a remote XAppStatusIcon */
 
+    /* Shown from the last session's snapshot while proxy is NULL */
+    IconSnapshotEntry *placeholder;
+
     GtkWidget *box;
     GtkWidget *image;
     GtkWidget *label;
 
-    gboolean highlight_both_menus;
+    /* Drawn instead of label when its width should not follow the text */
+    GtkWidget *stable_label;
+    PangoLayout *label_layout;
+    gint label_width; /* Reserved width, only ever grows */
+    gboolean stable_label_setting; /* Set by the plugin for every icon */
+
+    StatusIconMetadata metadata;
     gboolean menu_opened;
 
-    GCancellable *image_load_cancellable;
+    /* Built from the proxy's tooltip-text when a tooltip is asked for */
+    GtkWidget *tooltip_label;
+    gboolean tooltip_dirty;
+    gboolean hovered;
+
+    StatusIconStats own_stats;
+    StatusIconStats *stats; /* own_stats, unless the counters outlive the widget */
+
+    /* Screen coordinates sent along with clicks, computed ahead of time */
+    gboolean proxy_args_valid;
+    gint proxy_x;
+    gint proxy_y;
+
+    GCancellable *resolve_cancellable;
+    gboolean revalidating; /* The image came from a FileStamp, the query only checks it */
+
+    DecodeSlot *decode_slot;
+    FileImageRequest *pending_decode; /* What decode_slot is currently loading */
+    FileImageRequest *shown_file; /* The file last shown, to load it again at another scale */
+
+    /* Work deferred to the next frame */
+    guint tick_id;
+    guint fallback_id; /* Used instead of the frame clock while unrealized */
+    guint animation_id; /* Wakes the frame clock up for the next animation frame */
+    gboolean image_update_pending;
+    guint pending_changes; /* PropertyChanges */
+    gboolean image_dirty; /* Updates skipped while hidden */
+    gint64 last_image_update;
+    gint64 min_update_interval;
+
+    /* Scrolling not sent to the app yet, in wheel notches */
+    gdouble scroll_dx;
+    gdouble scroll_dy;
+    guint32 scroll_time;
+    gboolean scroll_pending;
+
+    /* Set when the app declares an animation in its metadata */
+    IconAnimation *animation;
+    cairo_surface_t *animation_frame; /* Owned by the animation */
 };
 
 G_DEFINE_TYPE (StatusIcon, status_icon, GTK_TYPE_TOGGLE_BUTTON)
 
 #define VERTICAL_PANEL(o) (o == GTK_POS_LEFT || o == GTK_POS_RIGHT)
 
-typedef struct {
-  gchar *path;
-  gint   width, height, scale;
-} ImageFromFileAsyncData;
+/* Placeholders have no proxy yet, their values come from the snapshot */
+static const gchar *
+get_icon_name (StatusIcon *icon)
+{
+    if (icon->proxy == NULL)
+    {
+        return icon->placeholder->icon_name;
+    }
+
+    return xapp_status_icon_interface_get_icon_name (icon->proxy);
+}
+
+static void
+file_image_request_free (FileImageRequest *request)
+{
+  g_free (request->path);
+  g_free (request);
+}
 
 static void
-sortable_name_changed (gpointer data)
+cancel_image_load (StatusIcon *icon)
 {
-    StatusIcon *icon = STATUS_ICON (data);
+    if (icon->pending_decode == NULL)
+    {
+        return;
+    }
 
-    g_signal_emit (icon, signals[RE_SORT], 0);
+    decode_slot_cancel (icon->decode_slot);
+    g_clear_pointer (&icon->pending_decode, file_image_request_free);
 }
 
 static void
-on_image_from_file_data_destroy (gpointer data)
+set_image_surface (StatusIcon      *icon,
+                   cairo_surface_t *surface)
 {
-  ImageFromFileAsyncData *d = (ImageFromFileAsyncData *)data;
-  g_free (d->path);
-  g_free (d);
+    gtk_image_set_pixel_size (GTK_IMAGE (icon->image), -1);
+    gtk_image_set_from_surface (GTK_IMAGE (icon->image), surface);
 }
 
 static void
-on_image_from_file_loaded (GObject      *source,
-                           GAsyncResult *res,
+on_image_from_file_loaded (DecodeSlot   *slot,
+                           GdkPixbuf    *pixbuf,
+                           const GError *error,
                            gpointer      user_data)
 {
     StatusIcon *icon = STATUS_ICON (user_data);
-    GTask *task = G_TASK (res);
-    GdkPixbuf *pixbuf;
+    FileImageRequest *request;
     cairo_surface_t *surface;
-    GError *error;
-    ImageFromFileAsyncData *data;
 
-    data = (ImageFromFileAsyncData *) g_task_get_task_data (task);
-    error = NULL;
+    PROFILE_BEGIN (profile_begin);
 
-    pixbuf = g_task_propagate_pointer (task, &error);
+    // The decode pool only delivers the result of our latest request.
+    request = icon->pending_decode;
+    icon->pending_decode = NULL;
 
-    g_clear_object (&icon->image_load_cancellable);
+    icon->stats->decodes++;
+    icon->stats->decode_time += decode_slot_get_decode_time (slot);
 
     if (error)
     {
-        if (error->code != G_IO_ERROR_CANCELLED)
-        {
-            g_warning ("Could not load image from file: %s\n", error->message);
-            g_error_free (error);
-        }
-
+        g_warning ("Could not load image from file: %s\n", error->message);
+        file_image_request_free (request);
         return;
     }
 
     surface = gdk_cairo_surface_create_from_pixbuf (pixbuf,
-                                                    data->scale,
+                                                    request->scale,
                                                     gtk_widget_get_window (GTK_WIDGET (icon)));
 
-    g_object_unref (pixbuf);
+    image_cache_insert (request->path, request->mtime, request->inode, request->height, request->scale, surface);
 
-    gtk_image_set_pixel_size (GTK_IMAGE (icon->image), -1);
-    gtk_image_set_from_surface (GTK_IMAGE (icon->image), surface);
+    set_image_surface (icon, surface);
+
+    PROFILE_END (profile_begin, "apply-decoded-image", request->path);
 
     cairo_surface_destroy (surface);
+    file_image_request_free (request);
+}
+
+static void
+load_file_based_image (StatusIcon  *icon,
+                       const gchar *path,
+                       guint64      mtime,
+                       guint64      inode,
+                       gint         icon_size)
+{
+    FileImageRequest *request;
+    cairo_surface_t *surface;
+    gint scale;
+
+    scale = gtk_widget_get_scale_factor (GTK_WIDGET (icon));
+
+    if (icon->shown_file == NULL || g_strcmp0 (icon->shown_file->path, path) != 0)
+    {
+        g_clear_pointer (&icon->shown_file, file_image_request_free);
+        icon->shown_file = g_new0 (FileImageRequest, 1);
+        icon->shown_file->path = g_strdup (path);
+    }
+
+    icon->shown_file->mtime = mtime;
+    icon->shown_file->inode = inode;
+    icon->shown_file->height = icon_size;
+    icon->shown_file->scale = scale;
+
+    surface = image_cache_lookup (path, mtime, inode, icon_size, scale);
+
+    if (surface != NULL)
+    {
+        icon->stats->cache_hits++;
+        cancel_image_load (icon);
+
+        set_image_surface (icon, surface);
+        cairo_surface_destroy (surface);
+        return;
+    }
+
+    request = g_new0 (FileImageRequest, 1);
+    request->path = g_strdup (path);
+    request->mtime = mtime;
+    request->inode = inode;
+    request->height = icon_size;
+    request->scale = scale;
+
+    g_clear_pointer (&icon->pending_decode, file_image_request_free);
+    icon->pending_decode = request;
+
+    // I can't imagine supporting a vertical panel somehow.. but the width is here in case.
+    decode_slot_request (icon->decode_slot,
+                         path,
+                         -1,
+                         icon_size,
+                         scale,
+                         gtk_widget_get_visible (GTK_WIDGET (icon)));
+}
+
+static gint
+get_icon_size (StatusIcon  *icon,
+               const gchar *icon_name)
+{
+    gboolean is_symbolic = !!g_strstr_len (icon_name, -1, "-symbolic");
+
+    return is_symbolic ? icon->symbolic_icon_size : icon->color_icon_size;
+}
+
+static void
+set_image_gicon (StatusIcon *icon,
+                 GIcon      *gicon,
+                 gint        icon_size)
+{
+    cancel_image_load (icon);
+    g_clear_pointer (&icon->shown_file, file_image_request_free);
+
+    gtk_image_set_pixel_size (GTK_IMAGE (icon->image),
+                              icon_size);
+
+    if (gicon)
+    {
+        gtk_image_set_from_gicon (GTK_IMAGE (icon->image), G_ICON (gicon), GTK_ICON_SIZE_MENU);
+    }
+    else
+    {
+        gtk_image_set_from_icon_name (GTK_IMAGE (icon->image), "image-missing", GTK_ICON_SIZE_MENU);
+    }
+}
+
+static void
+set_themed_image (StatusIcon  *icon,
+                  const gchar *icon_name)
+{
+    GtkIconTheme *theme = gtk_icon_theme_get_default ();
+    GIcon *gicon = NULL;
+
+    if (gtk_icon_theme_has_icon (theme, icon_name))
+    {
+        gicon = G_ICON (g_themed_icon_new (icon_name));
+    }
+
+    set_image_gicon (icon, gicon, get_icon_size (icon, icon_name));
+
+    g_clear_object (&gicon);
 }
 
 static void
-load_image_from_file_thread (GTask        *task,
-                             gpointer      source,
-                             gpointer      task_data,
-                             GCancellable *cancellable)
+set_file_image (StatusIcon  *icon,
+                const gchar *path,
+                guint64      mtime,
+                guint64      inode)
 {
-    ImageFromFileAsyncData *data;
-    GdkPixbuf *pixbuf;
+    gint icon_size;
+
+    icon_size = get_icon_size (icon, path);
+
+    if (g_strstr_len (path, -1, "-symbolic") != NULL || VERTICAL_PANEL (icon->orientation))
+    {
+        GFile *file = g_file_new_for_path (path);
+        GIcon *gicon = G_ICON (g_file_icon_new (file));
+
+        set_image_gicon (icon, gicon, icon_size);
+        g_object_unref (gicon);
+        g_object_unref (file);
+    }
+    else
+    {
+        load_file_based_image (icon, path, mtime, inode, icon_size);
+    }
+}
+
+static const FileStamp *
+lookup_file_stamp (const gchar *path)
+{
+    if (file_stamps == NULL)
+    {
+        return NULL;
+    }
+
+    return g_hash_table_lookup (file_stamps, path);
+}
+
+static void
+remember_file_stamp (const gchar *path,
+                     guint64      mtime,
+                     guint64      inode)
+{
+    FileStamp *stamp;
+
+    if (file_stamps == NULL)
+    {
+        file_stamps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    // Apps using a new temporary path for every icon would grow this forever.
+    if (g_hash_table_size (file_stamps) >= MAX_FILE_STAMPS &&
+        !g_hash_table_contains (file_stamps, path))
+    {
+        g_hash_table_remove_all (file_stamps);
+    }
+
+    stamp = g_new (FileStamp, 1);
+    stamp->mtime = mtime;
+    stamp->inode = inode;
+
+    g_hash_table_insert (file_stamps, g_strdup (path), stamp);
+}
+
+static void
+forget_file_stamp (const gchar *path)
+{
+    if (file_stamps != NULL)
+    {
+        g_hash_table_remove (file_stamps, path);
+    }
+}
+
+static void
+on_icon_file_info (GObject      *source,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+    StatusIcon *icon;
+    GFileInfo *info;
     GError *error;
+    const FileStamp *stamp;
+    gboolean unchanged;
+    guint64 mtime, inode;
+    gchar *path;
 
-    data = task_data;
     error = NULL;
+    info = g_file_query_info_finish (G_FILE (source), res, &error);
 
-    /* Pixbuf size is multiplied by the ui scale */
-    pixbuf = gdk_pixbuf_new_from_file_at_scale (data->path,
-                                                data->width > 0 ? data->width * data->scale : -1,
-                                                data->height > 0 ? data->height * data->scale : -1,
-                                                TRUE,
-                                                &error);
+    /* A newer icon name (or our disposal) cancelled this request, the icon
+     * must not be touched. */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_error_free (error);
+        return;
+    }
+
+    icon = STATUS_ICON (user_data);
+    g_clear_object (&icon->resolve_cancellable);
+
+    path = g_file_get_path (G_FILE (source));
 
     if (error)
     {
-        g_task_return_error (task, error);
+        // Not an existing file, so it can only be a themed icon (or a missing one).
+        icon->revalidating = FALSE;
+        forget_file_stamp (path);
+        set_themed_image (icon, get_icon_name (icon));
+        g_error_free (error);
+        g_free (path);
+        return;
+    }
+
+    mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+
+    // Nothing to do if the image shown from the stamp was the right one.
+    stamp = lookup_file_stamp (path);
+    unchanged = icon->revalidating &&
+                stamp != NULL &&
+                stamp->mtime == mtime &&
+                stamp->inode == inode;
+
+    icon->revalidating = FALSE;
+
+    if (!unchanged)
+    {
+        remember_file_stamp (path, mtime, inode);
+        set_file_image (icon, path, mtime, inode);
     }
 
-    g_task_return_pointer (task, pixbuf, NULL);
+    g_free (path);
+    g_object_unref (info);
 }
 
+static void schedule_frame_work (StatusIcon *icon);
+static void apply_property_changes (StatusIcon *icon,
+                                    guint       changes);
+
 static void
-load_file_based_image (StatusIcon  *icon,
-                       const gchar *path,
-                       gint         icon_size)
+do_update_image (StatusIcon *icon)
 {
+    const gchar *icon_name;
+    const FileStamp *stamp;
+    GFile *file;
+
+    // Anything queued for the next frame is covered by this update.
+    icon->image_update_pending = FALSE;
+    icon->stats->image_updates++;
 
-    ImageFromFileAsyncData *data;
-    GTask *result;
+    // A declared animation takes over the image, frames are played from the frame clock.
+    if (icon->animation != NULL)
+    {
+        cancel_image_load (icon);
+        g_clear_pointer (&icon->shown_file, file_image_request_free);
+
+        icon_animation_load (icon->animation,
+                             GTK_WIDGET (icon),
+                             icon->color_icon_size,
+                             icon->symbolic_icon_size);
+
+        icon->animation_frame = NULL;
+        schedule_frame_work (icon);
+        return;
+    }
+
+    icon_name = get_icon_name (icon);
 
-    data = g_new0 (ImageFromFileAsyncData, 1);
-    // I can't imagine supporting a vertical panel somehow.. but it's here in case.
-    data->width = -1;
-    data->height = icon_size;
-    data->scale = gtk_widget_get_scale_factor (GTK_WIDGET (icon));
-    data->path = g_strdup (path);
+    if (!icon_name)
+    {
+        return;
+    }
 
-    icon->image_load_cancellable = g_cancellable_new ();
+    if (icon->resolve_cancellable != NULL)
+    {
+        g_cancellable_cancel (icon->resolve_cancellable);
+        g_clear_object (&icon->resolve_cancellable);
+        icon->revalidating = FALSE;
+    }
 
-    result = g_task_new (icon,
-                         icon->image_load_cancellable,
-                         on_image_from_file_loaded,
-                         icon);
+    /* Theme icon names can't contain a directory separator, so only paths
+     * need to be probed, and that happens asynchronously to never block the
+     * panel on a slow filesystem. */
+    if (strchr (icon_name, G_DIR_SEPARATOR) == NULL)
+    {
+        set_themed_image (icon, icon_name);
+        return;
+    }
 
-    g_task_set_task_data (result, data, on_image_from_file_data_destroy);
-    g_task_run_in_thread (result, load_image_from_file_thread);
+    /* A file seen before is shown at once, straight from the caches when they
+     * hold it, and the query below only revalidates it. */
+    stamp = lookup_file_stamp (icon_name);
+    icon->revalidating = stamp != NULL;
 
-    g_object_unref (result);
+    if (stamp != NULL)
+    {
+        set_file_image (icon, icon_name, stamp->mtime, stamp->inode);
+    }
+
+    icon->resolve_cancellable = g_cancellable_new ();
+
+    file = g_file_new_for_path (icon_name);
+
+    g_file_query_info_async (file,
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_UNIX_INODE,
+                             G_FILE_QUERY_INFO_NONE,
+                             G_PRIORITY_DEFAULT,
+                             icon->resolve_cancellable,
+                             on_icon_file_info,
+                             icon);
+
+    g_object_unref (file);
+}
+
+/* Hidden icons, and icons the plugin keeps out of any container while they
+ * overflow, are not shown */
+static gboolean
+is_shown (StatusIcon *icon)
+{
+    return gtk_widget_get_visible (GTK_WIDGET (icon)) &&
+           gtk_widget_get_parent (GTK_WIDGET (icon)) != NULL;
 }
 
 static void
@@ -165,62 +543,288 @@ update_image (StatusIcon *icon)
 {
     g_return_if_fail (STATUS_IS_ICON (icon));
 
-    GIcon *gicon;
-    const gchar *icon_name;
-    gboolean is_symbolic = FALSE;
-    gint icon_size;
+    /* Icons that aren't shown only remember that their image is out of date,
+     * it gets resolved and decoded once they are. */
+    if (!is_shown (icon))
+    {
+        icon->image_update_pending = FALSE;
+        icon->image_dirty = TRUE;
+        return;
+    }
 
-    icon_name = xapp_status_icon_interface_get_icon_name (XAPP_STATUS_ICON_INTERFACE (icon->proxy));
-    gicon = NULL;
+    icon->image_dirty = FALSE;
 
-    if (!icon_name)
+    PROFILE_BEGIN (profile_begin);
+
+    do_update_image (icon);
+
+    PROFILE_END (profile_begin, "update-image", get_icon_name (icon));
+}
+
+/* Sends whole scroll steps accumulated since the last frame, one call per
+ * axis, and keeps the fraction for later */
+static void
+flush_scroll (StatusIcon *icon)
+{
+    gint steps;
+
+    icon->scroll_pending = FALSE;
+
+    steps = (gint) icon->scroll_dy;
+
+    if (steps != 0)
     {
-        return;
+        xapp_status_icon_interface_call_scroll (icon->proxy,
+                                                steps,
+                                                steps < 0 ? XAPP_SCROLL_UP : XAPP_SCROLL_DOWN,
+                                                icon->scroll_time,
+                                                NULL,
+                                                NULL,
+                                                NULL);
+
+        icon->stats->scrolls++;
+        icon->scroll_dy -= steps;
     }
 
-    is_symbolic = !!g_strstr_len (icon_name, -1, "-symbolic");
-    icon_size = is_symbolic ? icon->symbolic_icon_size : icon->color_icon_size;
+    steps = (gint) icon->scroll_dx;
 
-    if (g_file_test (icon_name, G_FILE_TEST_EXISTS))
+    if (steps != 0)
     {
-        if (is_symbolic || VERTICAL_PANEL (icon->orientation))
-        {
-            GFile *icon_file = g_file_new_for_path (icon_name);
-            gicon = G_ICON (g_file_icon_new (icon_file));
-            g_object_unref (icon_file);
-        }
-        else
+        xapp_status_icon_interface_call_scroll (icon->proxy,
+                                                steps,
+                                                steps < 0 ? XAPP_SCROLL_LEFT : XAPP_SCROLL_RIGHT,
+                                                icon->scroll_time,
+                                                NULL,
+                                                NULL,
+                                                NULL);
+
+        icon->stats->scrolls++;
+        icon->scroll_dx -= steps;
+    }
+}
+
+static gboolean
+on_animation_wakeup (gpointer user_data)
+{
+    StatusIcon *icon = STATUS_ICON (user_data);
+
+    icon->animation_id = 0;
+    schedule_frame_work (icon);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns TRUE while some work still has to wait for a later frame */
+static gboolean
+run_frame_work (StatusIcon *icon,
+                gint64      frame_time)
+{
+    gboolean more_work = FALSE;
+
+    if (icon->scroll_pending)
+    {
+        flush_scroll (icon);
+    }
+
+    // Before the image, a new icon name queues its update for this same frame.
+    if (icon->pending_changes != 0)
+    {
+        guint changes = icon->pending_changes;
+
+        icon->pending_changes = 0;
+        apply_property_changes (icon, changes);
+    }
+
+    if (icon->image_update_pending)
+    {
+        if (frame_time - icon->last_image_update >= icon->min_update_interval)
         {
-            load_file_based_image(icon, icon_name, icon_size);
-            return;
+            icon->last_image_update = frame_time;
+            update_image (icon);
         }
+
+        more_work |= icon->image_update_pending;
     }
-    else
+
+    // Animations only play while shown, and with a frame clock to drive them.
+    if (icon->animation != NULL &&
+        is_shown (icon) &&
+        gtk_widget_get_realized (GTK_WIDGET (icon)))
     {
-        GtkIconTheme *theme = gtk_icon_theme_get_default ();
+        cairo_surface_t *frame = icon_animation_get_frame (icon->animation, frame_time);
+
+        if (frame != NULL && frame != icon->animation_frame)
+        {
+            icon->animation_frame = frame;
+            set_image_surface (icon, frame);
+        }
 
-        if (gtk_icon_theme_has_icon (theme, icon_name))
+        // Sleep until the next frame is due, instead of ticking at the display rate.
+        if (!more_work && icon->animation_id == 0)
         {
-            gicon = G_ICON (g_themed_icon_new (icon_name));
+            gint64 delay = icon_animation_get_next_frame_time (icon->animation, frame_time) - g_get_monotonic_time ();
 
+            icon->animation_id = g_timeout_add ((MAX (delay, 0) + 999) / 1000, on_animation_wakeup, icon);
         }
     }
 
-    gtk_image_set_pixel_size (GTK_IMAGE (icon->image),
-                              icon_size);
+    return more_work;
+}
 
-    if (gicon)
+static gboolean
+on_frame_tick (GtkWidget     *widget,
+               GdkFrameClock *frame_clock,
+               gpointer       user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+
+    if (run_frame_work (icon, gdk_frame_clock_get_frame_time (frame_clock)))
     {
-        gtk_image_set_from_gicon (GTK_IMAGE (icon->image), G_ICON (gicon), GTK_ICON_SIZE_MENU);
+        return G_SOURCE_CONTINUE;
+    }
 
-        g_object_unref (gicon);
+    icon->tick_id = 0;
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_frame_fallback (gpointer user_data)
+{
+    StatusIcon *icon = STATUS_ICON (user_data);
+
+    icon->fallback_id = 0;
+
+    if (run_frame_work (icon, g_get_monotonic_time ()))
+    {
+        schedule_frame_work (icon);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_frame_work (StatusIcon *icon)
+{
+    gint64 delay;
+
+    if (icon->tick_id > 0 || icon->fallback_id > 0)
+    {
+        return;
+    }
+
+    if (gtk_widget_get_realized (GTK_WIDGET (icon)))
+    {
+        icon->tick_id = gtk_widget_add_tick_callback (GTK_WIDGET (icon), on_frame_tick, NULL, NULL);
+        return;
+    }
+
+    // Without a frame clock, wait until the rate limit allows the next update.
+    delay = 0;
+
+    if (icon->image_update_pending && icon->pending_changes == 0)
+    {
+        delay = icon->last_image_update + icon->min_update_interval - g_get_monotonic_time ();
+    }
+
+    icon->fallback_id = g_timeout_add (MAX (delay, 0) / 1000, on_frame_fallback, icon);
+}
+
+static void
+on_realize (GtkWidget *widget,
+            gpointer   user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+
+    // Switch from the fallback timeout to the frame clock we now have.
+    if (icon->fallback_id > 0)
+    {
+        g_source_remove (icon->fallback_id);
+        icon->fallback_id = 0;
+    }
+
+    if (icon->image_update_pending || icon->pending_changes != 0 || icon->animation != NULL)
+    {
+        schedule_frame_work (icon);
+    }
+}
+
+static void
+on_shown_changed (GtkWidget  *widget,
+                  GParamSpec *pspec,
+                  gpointer    user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+
+    if (!is_shown (icon))
+    {
+        return;
+    }
+
+    if (icon->image_dirty)
+    {
+        update_image (icon);
     }
     else
+    if (icon->animation != NULL)
     {
-        gtk_image_set_from_icon_name (GTK_IMAGE (icon->image), "image-missing", GTK_ICON_SIZE_MENU);
+        schedule_frame_work (icon);
     }
 }
 
+static void
+queue_image_update (StatusIcon *icon)
+{
+    icon->image_update_pending = TRUE;
+
+    schedule_frame_work (icon);
+}
+
+/* The panel moved to a monitor with another scale. Themed icons are looked
+ * up again by the GtkImage itself, file images and animations are ours. */
+static void
+on_scale_factor_changed (GtkWidget  *widget,
+                         GParamSpec *pspec,
+                         gpointer    user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+    FileImageRequest *file;
+
+    // A full update is on its way already, and will use the new scale.
+    if (icon->image_update_pending || (icon->resolve_cancellable != NULL && !icon->revalidating))
+    {
+        return;
+    }
+
+    if (icon->animation != NULL)
+    {
+        queue_image_update (icon);
+        return;
+    }
+
+    if (icon->shown_file == NULL ||
+        icon->shown_file->scale == gtk_widget_get_scale_factor (widget))
+    {
+        return;
+    }
+
+    if (!is_shown (icon))
+    {
+        icon->image_dirty = TRUE;
+        return;
+    }
+
+    /* Same file, so no need to resolve it again: the variant for the new
+     * scale comes from the caches, or is decoded in the background while
+     * the current one stays up. */
+    file = icon->shown_file;
+    icon->shown_file = NULL;
+
+    load_file_based_image (icon, file->path, file->mtime, file->inode, file->height);
+
+    file_image_request_free (file);
+}
+
 static void
 calculate_proxy_args (StatusIcon *icon,
                       gint       *x,
@@ -264,6 +868,335 @@ calculate_proxy_args (StatusIcon *icon,
     *y = final_y;
 }
 
+static void
+invalidate_proxy_args (StatusIcon *icon)
+{
+    icon->proxy_args_valid = FALSE;
+}
+
+/* gdk_window_get_origin() is a server round trip on X11, so the result is
+ * cached (and computed as soon as the pointer enters the icon) to keep it
+ * off the click path. */
+static void
+get_proxy_args (StatusIcon *icon,
+                gint       *x,
+                gint       *y)
+{
+    if (!icon->proxy_args_valid)
+    {
+        calculate_proxy_args (icon, &icon->proxy_x, &icon->proxy_y);
+        icon->proxy_args_valid = TRUE;
+    }
+
+    *x = icon->proxy_x;
+    *y = icon->proxy_y;
+}
+
+static gboolean
+on_enter_notify_event (GtkWidget        *widget,
+                       GdkEventCrossing *event,
+                       gpointer          user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+    gint x, y;
+
+    icon->hovered = TRUE;
+    get_proxy_args (icon, &x, &y);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static gboolean
+on_leave_notify_event (GtkWidget        *widget,
+                       GdkEventCrossing *event,
+                       gpointer          user_data)
+{
+    /* The panel can move without us getting any event for it (an embedded
+     * plugin window keeps its position inside the panel), so never trust the
+     * cache beyond the current hover. */
+    invalidate_proxy_args (STATUS_ICON (widget));
+    STATUS_ICON (widget)->hovered = FALSE;
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static gboolean
+on_toplevel_configure_event (StatusIcon *icon,
+                             GdkEvent   *event,
+                             GtkWidget  *toplevel)
+{
+    invalidate_proxy_args (icon);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void
+on_hierarchy_changed (GtkWidget *widget,
+                      GtkWidget *previous_toplevel,
+                      gpointer   user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+    GtkWidget *toplevel;
+
+    if (previous_toplevel != NULL)
+    {
+        g_signal_handlers_disconnect_by_func (previous_toplevel, on_toplevel_configure_event, icon);
+    }
+
+    invalidate_proxy_args (icon);
+
+    toplevel = gtk_widget_get_toplevel (widget);
+
+    if (gtk_widget_is_toplevel (toplevel))
+    {
+        g_signal_connect_object (toplevel,
+                                 "configure-event",
+                                 G_CALLBACK (on_toplevel_configure_event),
+                                 icon,
+                                 G_CONNECT_SWAPPED);
+    }
+}
+
+static gboolean
+use_stable_label (StatusIcon *icon)
+{
+    return icon->stable_label_setting ||
+           icon->metadata.stable_label ||
+           icon->metadata.label_template != NULL;
+}
+
+static const gchar *
+get_label_text (StatusIcon *icon)
+{
+    const gchar *text;
+
+    if (icon->proxy == NULL)
+    {
+        text = icon->placeholder->label;
+    }
+    else
+    {
+        text = xapp_status_icon_interface_get_label (icon->proxy);
+    }
+
+    return text != NULL ? text : "";
+}
+
+static void
+ensure_label_layout (StatusIcon *icon)
+{
+    PangoAttrList *attrs;
+
+    if (icon->label_layout != NULL)
+    {
+        return;
+    }
+
+    icon->label_layout = gtk_widget_create_pango_layout (icon->stable_label, NULL);
+
+    // Tabular digits all have the same width, so changing numbers don't shift around.
+    attrs = pango_attr_list_new ();
+    pango_attr_list_insert (attrs, pango_attr_font_features_new ("tnum"));
+    pango_layout_set_attributes (icon->label_layout, attrs);
+    pango_attr_list_unref (attrs);
+
+    icon->label_width = 0;
+
+    if (icon->metadata.label_template != NULL)
+    {
+        pango_layout_set_text (icon->label_layout, icon->metadata.label_template, -1);
+        pango_layout_get_pixel_size (icon->label_layout, &icon->label_width, NULL);
+    }
+}
+
+/* Only asks for more room when the text is wider than the template and
+ * anything shown before, otherwise it just redraws. */
+static void
+update_stable_label (StatusIcon *icon)
+{
+    gint width, height, request_width;
+
+    ensure_label_layout (icon);
+
+    pango_layout_set_text (icon->label_layout, get_label_text (icon), -1);
+    pango_layout_get_pixel_size (icon->label_layout, &width, &height);
+
+    icon->label_width = MAX (icon->label_width, width);
+
+    gtk_widget_get_size_request (icon->stable_label, &request_width, NULL);
+
+    if (request_width != icon->label_width)
+    {
+        gtk_widget_set_size_request (icon->stable_label, icon->label_width, height);
+    }
+
+    gtk_widget_queue_draw (icon->stable_label);
+}
+
+static gboolean
+on_stable_label_draw (GtkWidget *widget,
+                      cairo_t   *cr,
+                      gpointer   user_data)
+{
+    StatusIcon *icon = STATUS_ICON (user_data);
+    gint width, height, x = 0;
+
+    if (icon->label_layout == NULL)
+    {
+        return GDK_EVENT_PROPAGATE;
+    }
+
+    pango_layout_get_pixel_size (icon->label_layout, &width, &height);
+
+    // The text starts at the leading edge of its slot, the right one in RTL locales.
+    if (gtk_widget_get_direction (widget) == GTK_TEXT_DIR_RTL)
+    {
+        x = gtk_widget_get_allocated_width (widget) - width;
+    }
+
+    gtk_render_layout (gtk_widget_get_style_context (widget),
+                       cr,
+                       x, (gtk_widget_get_allocated_height (widget) - height) / 2,
+                       icon->label_layout);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void
+on_stable_label_style_updated (GtkWidget *widget,
+                               gpointer   user_data)
+{
+    StatusIcon *icon = STATUS_ICON (user_data);
+
+    // The font may have changed, measure everything again.
+    g_clear_object (&icon->label_layout);
+
+    if (gtk_widget_get_visible (widget))
+    {
+        update_stable_label (icon);
+    }
+}
+
+static void
+set_label_visible (StatusIcon *icon,
+                   gboolean    visible)
+{
+    gboolean stable = visible && use_stable_label (icon);
+    gint margin = visible ? VISIBLE_LABEL_MARGIN : 0;
+
+    if (visible && !stable)
+    {
+        gtk_label_set_label (GTK_LABEL (icon->label), get_label_text (icon));
+    }
+
+    gtk_widget_set_visible (icon->label, visible && !stable);
+    gtk_widget_set_margin_start (icon->label, margin);
+
+    gtk_widget_set_visible (icon->stable_label, stable);
+    gtk_widget_set_margin_start (icon->stable_label, margin);
+
+    if (stable)
+    {
+        update_stable_label (icon);
+    }
+}
+
+static gboolean
+label_is_visible (StatusIcon *icon)
+{
+    return gtk_widget_get_visible (icon->label) || gtk_widget_get_visible (icon->stable_label);
+}
+
+static void
+on_label_changed (StatusIcon *icon)
+{
+    // A stable label redraws in place, the GtkLabel would relayout the panel every time.
+    if (gtk_widget_get_visible (icon->stable_label))
+    {
+        update_stable_label (icon);
+        return;
+    }
+
+    gtk_label_set_label (GTK_LABEL (icon->label), get_label_text (icon));
+}
+
+static const gchar *
+get_tooltip_text (StatusIcon *icon)
+{
+    const gchar *text = NULL;
+
+    if (icon->proxy != NULL)
+    {
+        text = xapp_status_icon_interface_get_tooltip_text (icon->proxy);
+    }
+
+    return text != NULL ? text : "";
+}
+
+static gboolean
+on_query_tooltip (GtkWidget  *widget,
+                  gint        x,
+                  gint        y,
+                  gboolean    keyboard_mode,
+                  GtkTooltip *tooltip,
+                  gpointer    user_data)
+{
+    StatusIcon *icon = STATUS_ICON (widget);
+    const gchar *text = get_tooltip_text (icon);
+
+    if (text[0] == '\0')
+    {
+        return FALSE;
+    }
+
+    if (icon->tooltip_label == NULL)
+    {
+        // Wraps like the label GtkTooltip uses for its own markup
+        icon->tooltip_label = g_object_ref_sink (gtk_label_new (NULL));
+        gtk_label_set_line_wrap (GTK_LABEL (icon->tooltip_label), TRUE);
+        gtk_label_set_max_width_chars (GTK_LABEL (icon->tooltip_label), 70);
+        gtk_widget_show (icon->tooltip_label);
+    }
+
+    // Markup is only parsed once per change, not on every query.
+    if (icon->tooltip_dirty)
+    {
+        if (pango_parse_markup (text, -1, 0, NULL, NULL, NULL, NULL))
+        {
+            gtk_label_set_markup (GTK_LABEL (icon->tooltip_label), text);
+        }
+        else
+        {
+            gtk_label_set_text (GTK_LABEL (icon->tooltip_label), text);
+        }
+
+        icon->tooltip_dirty = FALSE;
+    }
+
+    gtk_tooltip_set_custom (tooltip, icon->tooltip_label);
+
+    return TRUE;
+}
+
+static void
+on_tooltip_changed (StatusIcon *icon)
+{
+    gboolean has_tooltip = get_tooltip_text (icon)[0] != '\0';
+
+    icon->tooltip_dirty = TRUE;
+
+    if (gtk_widget_get_has_tooltip (GTK_WIDGET (icon)) != has_tooltip)
+    {
+        gtk_widget_set_has_tooltip (GTK_WIDGET (icon), has_tooltip);
+    }
+
+    // Nobody can be looking at the tooltip unless the pointer is over us.
+    if (icon->hovered && has_tooltip)
+    {
+        gtk_widget_trigger_tooltip_query (GTK_WIDGET (icon));
+    }
+}
+
 static void
 update_orientation (StatusIcon *icon)
 {
@@ -272,17 +1205,15 @@ update_orientation (StatusIcon *icon)
         case GTK_POS_TOP:
         case GTK_POS_BOTTOM:
             gtk_orientable_set_orientation (GTK_ORIENTABLE (icon->box), GTK_ORIENTATION_HORIZONTAL);
-            if (strlen (gtk_label_get_label (GTK_LABEL (icon->label))) > 0)
+            if (strlen (get_label_text (icon)) > 0)
             {
-                gtk_widget_set_visible (icon->label, TRUE);
-                gtk_widget_set_margin_start (icon->label, VISIBLE_LABEL_MARGIN);
+                set_label_visible (icon, TRUE);
             }
             break;
         case GTK_POS_LEFT:
         case GTK_POS_RIGHT:
             gtk_orientable_set_orientation (GTK_ORIENTABLE (icon->box), GTK_ORIENTATION_VERTICAL);
-            gtk_widget_set_visible (icon->label, FALSE);
-            gtk_widget_set_margin_start (icon->label, 0);
+            set_label_visible (icon, FALSE);
             break;
     }
 }
@@ -325,9 +1256,19 @@ on_button_press_event (GtkWidget *widget,
     x = 0;
     y = 0;
 
+    // Placeholders don't react until their app shows up.
+    if (icon->proxy == NULL)
+    {
+        return GDK_EVENT_STOP;
+    }
+
     icon->menu_opened = FALSE;
 
-    calculate_proxy_args (icon, &x, &y);
+    get_proxy_args (icon, &x, &y);
+
+    icon->stats->button_presses++;
+
+    PROFILE_BEGIN (profile_begin);
 
     xapp_status_icon_interface_call_button_press (icon->proxy,
                                                   x, y,
@@ -338,6 +1279,8 @@ on_button_press_event (GtkWidget *widget,
                                                   NULL,
                                                   NULL);
 
+    PROFILE_END (profile_begin, "button-press", NULL);
+
     return GDK_EVENT_STOP;
 }
 
@@ -349,10 +1292,19 @@ on_button_release_event (GtkWidget *widget,
     StatusIcon *icon = STATUS_ICON (widget);
     gint x, y;
 
-    x = 0;
-    y = 0;
+    x = 0;
+    y = 0;
+
+    if (icon->proxy == NULL)
+    {
+        return GDK_EVENT_STOP;
+    }
+
+    get_proxy_args (icon, &x, &y);
+
+    icon->stats->button_releases++;
 
-    calculate_proxy_args (icon, &x, &y);
+    PROFILE_BEGIN (profile_begin);
 
     xapp_status_icon_interface_call_button_release (icon->proxy,
                                                     x, y,
@@ -363,8 +1315,10 @@ on_button_release_event (GtkWidget *widget,
                                                     NULL,
                                                     NULL);
 
+    PROFILE_END (profile_begin, "button-release", NULL);
+
     if (event->button.button == GDK_BUTTON_PRIMARY ||
-        (event->button.button == GDK_BUTTON_SECONDARY && icon->highlight_both_menus))
+        (event->button.button == GDK_BUTTON_SECONDARY && icon->metadata.highlight_both_menus))
     {
         icon->menu_opened = TRUE;
     }
@@ -379,43 +1333,50 @@ on_scroll_event (GtkWidget *widget,
 {
     StatusIcon *icon = STATUS_ICON (widget);
     GdkScrollDirection direction;
-    XAppScrollDirection x_dir = XAPP_SCROLL_UP;
-    gint delta = 0;
+    gdouble dx, dy;
 
-    if (gdk_event_get_scroll_direction (event, &direction))
+    if (icon->proxy == NULL)
     {
-        x_dir = direction;
+        return GDK_EVENT_STOP;
+    }
 
+    if (gdk_event_get_scroll_direction (event, &direction))
+    {
         switch (direction)
         {
             case GDK_SCROLL_UP:
-                delta = -1;
+                icon->scroll_dy -= 1;
                 break;
             case GDK_SCROLL_DOWN:
-                delta = 1;
+                icon->scroll_dy += 1;
                 break;
             case GDK_SCROLL_LEFT:
-                delta = -1;
+                icon->scroll_dx -= 1;
                 break;
             case GDK_SCROLL_RIGHT:
-                delta = 1;
+                icon->scroll_dx += 1;
                 break;
             default:
-                break;
+                return GDK_EVENT_PROPAGATE;
         }
     }
-
-    if (delta != 0)
+    else
+    if (gdk_event_get_scroll_deltas (event, &dx, &dy))
     {
-        xapp_status_icon_interface_call_scroll (icon->proxy,
-                                                delta,
-                                                x_dir,
-                                                event->button.time,
-                                                NULL,
-                                                NULL,
-                                                NULL);
+        icon->scroll_dx += dx;
+        icon->scroll_dy += dy;
+    }
+    else
+    {
+        return GDK_EVENT_PROPAGATE;
     }
 
+    // Sent on the next frame, together with anything else scrolled until then.
+    icon->scroll_time = gdk_event_get_time (event);
+    icon->scroll_pending = TRUE;
+
+    schedule_frame_work (icon);
+
     return GDK_EVENT_PROPAGATE;
 }
 
@@ -423,10 +1384,23 @@ static void
 status_icon_init (StatusIcon *icon)
 {
     GtkStyleContext *context;
-    GtkCssProvider  *provider;
     icon->box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
-
-    gtk_widget_add_events (GTK_WIDGET (icon), GDK_SCROLL_MASK);
+    icon->decode_slot = decode_slot_new (on_image_from_file_loaded, icon);
+    icon->stats = &icon->own_stats;
+
+    gtk_widget_add_events (GTK_WIDGET (icon), GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+    g_signal_connect_after (GTK_WIDGET (icon), "realize", G_CALLBACK (on_realize), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "hierarchy-changed", G_CALLBACK (on_hierarchy_changed), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "notify::visible", G_CALLBACK (on_shown_changed), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "notify::parent", G_CALLBACK (on_shown_changed), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "notify::scale-factor", G_CALLBACK (on_scale_factor_changed), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "button-press-event", G_CALLBACK (on_button_press_event), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "button-release-event", G_CALLBACK (on_button_release_event), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "scroll-event", G_CALLBACK (on_scroll_event), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "enter-notify-event", G_CALLBACK (on_enter_notify_event), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "leave-notify-event", G_CALLBACK (on_leave_notify_event), NULL);
+    g_signal_connect (GTK_WIDGET (icon), "query-tooltip", G_CALLBACK (on_query_tooltip), NULL);
+    g_signal_connect_swapped (GTK_WIDGET (icon), "size-allocate", G_CALLBACK (invalidate_proxy_args), icon);
 
     gtk_container_add (GTK_CONTAINER (icon), icon->box);
 
@@ -435,8 +1409,14 @@ status_icon_init (StatusIcon *icon)
     icon->label = gtk_label_new (NULL);
     gtk_widget_set_no_show_all (icon->label, TRUE);
 
+    icon->stable_label = gtk_drawing_area_new ();
+    gtk_widget_set_no_show_all (icon->stable_label, TRUE);
+    g_signal_connect (icon->stable_label, "draw", G_CALLBACK (on_stable_label_draw), icon);
+    g_signal_connect (icon->stable_label, "style-updated", G_CALLBACK (on_stable_label_style_updated), icon);
+
     gtk_box_pack_start (GTK_BOX (icon->box), icon->image, TRUE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX (icon->box), icon->label, FALSE, FALSE, 0);
+    gtk_box_pack_start (GTK_BOX (icon->box), icon->stable_label, FALSE, FALSE, 0);
 
     gtk_widget_set_can_default (GTK_WIDGET (icon), FALSE);
     gtk_widget_set_can_focus (GTK_WIDGET (icon), FALSE);
@@ -447,10 +1427,8 @@ status_icon_init (StatusIcon *icon)
     /* Make sure themes like Adwaita, which set excessive padding, don't cause the
        launcher buttons to overlap when panels have a fairly normal size */
     context = gtk_widget_get_style_context (GTK_WIDGET (icon));
-    provider = gtk_css_provider_new ();
-    gtk_css_provider_load_from_data (provider, ".xfce4-panel button { padding: 1px; }", -1, NULL);
     gtk_style_context_add_provider (context,
-                                    GTK_STYLE_PROVIDER (provider),
+                                    GTK_STYLE_PROVIDER (icon_css_provider),
                                     GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
 }
 
@@ -459,63 +1437,115 @@ status_icon_dispose (GObject *object)
 {
     StatusIcon *icon = STATUS_ICON (object);
 
-    g_clear_object (&icon->proxy);
-    g_clear_object (&icon->image_load_cancellable);
+    if (icon->resolve_cancellable != NULL)
+    {
+        g_cancellable_cancel (icon->resolve_cancellable);
+        g_clear_object (&icon->resolve_cancellable);
+    }
+
+    if (icon->decode_slot != NULL)
+    {
+        g_clear_pointer (&icon->pending_decode, file_image_request_free);
+        g_clear_pointer (&icon->decode_slot, decode_slot_free);
+    }
+
+    g_clear_pointer (&icon->shown_file, file_image_request_free);
+
+    if (icon->tick_id > 0)
+    {
+        gtk_widget_remove_tick_callback (GTK_WIDGET (icon), icon->tick_id);
+        icon->tick_id = 0;
+    }
+
+    if (icon->fallback_id > 0)
+    {
+        g_source_remove (icon->fallback_id);
+        icon->fallback_id = 0;
+    }
+
+    if (icon->animation_id > 0)
+    {
+        g_source_remove (icon->animation_id);
+        icon->animation_id = 0;
+    }
+
+    g_clear_pointer (&icon->animation, icon_animation_free);
+    icon->animation_frame = NULL;
+
+    g_clear_object (&icon->label_layout);
+    g_clear_object (&icon->tooltip_label);
+
+    if (icon->proxy != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (icon->proxy, icon);
+        g_clear_object (&icon->proxy);
+    }
 
     G_OBJECT_CLASS (status_icon_parent_class)->dispose (object);
 }
 
+static void
+status_icon_finalize (GObject *object)
+{
+    StatusIcon *icon = STATUS_ICON (object);
+
+    g_strfreev (icon->metadata.animation_frames);
+    g_free (icon->metadata.label_template);
+    g_clear_pointer (&icon->placeholder, icon_snapshot_entry_free);
+
+    G_OBJECT_CLASS (status_icon_parent_class)->finalize (object);
+}
+
 static void
 status_icon_class_init (StatusIconClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     object_class->dispose = status_icon_dispose;
+    object_class->finalize = status_icon_finalize;
 
-    signals [RE_SORT] =
-    g_signal_new ("re-sort",
-                  STATUS_TYPE_ICON,
-                  G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
-                  0,
-                  NULL, NULL, NULL,
-                  G_TYPE_NONE, 0);
+    icon_css_provider = gtk_css_provider_new ();
+    gtk_css_provider_load_from_data (icon_css_provider, ".xfce4-panel button { padding: 1px; }", -1, NULL);
 }
 
-static void
-bind_props_and_signals (StatusIcon *icon)
+static gchar **
+read_string_array (JsonReader *reader)
 {
-    guint flags = G_BINDING_DEFAULT | G_BINDING_SYNC_CREATE;
+    GPtrArray *strings;
+    gint i, n_elements;
 
-    g_object_bind_property (icon->proxy, "label", icon->label, "label", flags);
-    g_object_bind_property (icon->proxy, "tooltip-text", GTK_BUTTON (icon), "tooltip-markup", flags);
-    g_object_bind_property (icon->proxy, "visible", GTK_BUTTON (icon), "visible", flags);
+    if (!json_reader_is_array (reader))
+    {
+        return NULL;
+    }
 
-    g_signal_connect (icon->proxy, "notify::primary-menu-is-open", G_CALLBACK (menu_visible_changed), icon);
-    g_signal_connect (icon->proxy, "notify::secondary-menu-is-open", G_CALLBACK (menu_visible_changed), icon);
-    g_signal_connect_swapped (icon->proxy, "notify::icon-name", G_CALLBACK (update_image), icon);
-    g_signal_connect_swapped (icon->proxy, "notify::name", G_CALLBACK (sortable_name_changed), icon);
+    n_elements = json_reader_count_elements (reader);
+    strings = g_ptr_array_new ();
 
-    g_signal_connect (GTK_WIDGET (icon), "button-press-event", G_CALLBACK (on_button_press_event), NULL);
-    g_signal_connect (GTK_WIDGET (icon), "button-release-event", G_CALLBACK (on_button_release_event), NULL);
-    g_signal_connect (GTK_WIDGET (icon), "scroll-event", G_CALLBACK (on_scroll_event), NULL);
+    for (i = 0; i < n_elements; i++)
+    {
+        json_reader_read_element (reader, i);
+
+        if (json_reader_is_value (reader) && json_reader_get_string_value (reader) != NULL)
+        {
+            g_ptr_array_add (strings, g_strdup (json_reader_get_string_value (reader)));
+        }
+
+        json_reader_end_element (reader);
+    }
+
+    g_ptr_array_add (strings, NULL);
+
+    return (gchar **) g_ptr_array_free (strings, FALSE);
 }
 
-static void
-load_metadata (StatusIcon *icon)
+static gboolean
+parse_metadata (const gchar        *data,
+                StatusIconMetadata *metadata)
 {
     g_autoptr (JsonParser) parser = NULL;
+    g_autoptr (JsonReader) reader = NULL;
     GError *error;
-    JsonNode *root, *child;
-    JsonObject *dict;
-    JsonObjectIter iter;
-    const gchar *data, *child_name;
-
-    data = xapp_status_icon_interface_get_metadata (icon->proxy);
-
-    if (data == NULL || data[0] == '\0')
-    {
-        return;
-    }
 
     parser = json_parser_new ();
     error = NULL;
@@ -524,24 +1554,234 @@ load_metadata (StatusIcon *icon)
     {
         g_warning ("Could not parse icon metadata: %s\n", error->message);
         g_error_free (error);
-        return;
+        return FALSE;
+    }
+
+    reader = json_reader_new (json_parser_get_root (parser));
+
+    if (!json_reader_is_object (reader))
+    {
+        g_warning ("Icon metadata is not a json object\n");
+        return FALSE;
+    }
+
+    // Unknown members are skipped, and end_member() also resets the reader after a missing one.
+    if (json_reader_read_member (reader, "highlight-both-menus"))
+    {
+        metadata->highlight_both_menus = json_reader_get_boolean_value (reader);
+    }
+    json_reader_end_member (reader);
+
+    if (json_reader_read_member (reader, "animation-frames"))
+    {
+        metadata->animation_frames = read_string_array (reader);
+    }
+    json_reader_end_member (reader);
+
+    if (json_reader_read_member (reader, "animation-interval"))
+    {
+        metadata->animation_interval = json_reader_get_int_value (reader);
+    }
+    json_reader_end_member (reader);
+
+    if (json_reader_read_member (reader, "stable-label"))
+    {
+        metadata->stable_label = json_reader_get_boolean_value (reader);
+    }
+    json_reader_end_member (reader);
+
+    if (json_reader_read_member (reader, "label-template"))
+    {
+        metadata->label_template = g_strdup (json_reader_get_string_value (reader));
+    }
+    json_reader_end_member (reader);
+
+    return TRUE;
+}
+
+static gboolean
+strv_equal (gchar **a,
+            gchar **b)
+{
+    if (a == NULL || b == NULL)
+    {
+        return a == b;
+    }
+
+    while (*a != NULL && *b != NULL)
+    {
+        if (g_strcmp0 (*a++, *b++) != 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return *a == *b;
+}
+
+/* Switches a shown label between the GtkLabel and the stable one */
+static void
+refresh_label_mode (StatusIcon *icon)
+{
+    // The reserved width depends on the template
+    g_clear_object (&icon->label_layout);
+
+    if (label_is_visible (icon))
+    {
+        set_label_visible (icon, TRUE);
+    }
+}
+
+static void
+load_metadata (StatusIcon *icon)
+{
+    StatusIconMetadata metadata = { 0, };
+    const gchar *data;
+    gboolean label_changed;
+
+    data = icon->proxy != NULL ? xapp_status_icon_interface_get_metadata (icon->proxy) : NULL;
+
+    if (data != NULL && data[0] != '\0')
+    {
+        if (!parse_metadata (data, &metadata))
+        {
+            g_strfreev (metadata.animation_frames);
+            g_free (metadata.label_template);
+            return;
+        }
     }
 
-    root = json_parser_get_root (parser);
+    // Only act on what changed
+    icon->metadata.highlight_both_menus = metadata.highlight_both_menus;
 
-    g_return_if_fail (JSON_NODE_TYPE (root) == JSON_NODE_OBJECT);
+    if (!strv_equal (metadata.animation_frames, icon->metadata.animation_frames) ||
+        metadata.animation_interval != icon->metadata.animation_interval)
+    {
+        g_clear_pointer (&icon->animation, icon_animation_free);
+        icon->animation_frame = NULL;
+
+        if (metadata.animation_frames != NULL && metadata.animation_frames[0] != NULL)
+        {
+            icon->animation = icon_animation_new ((const gchar * const *) metadata.animation_frames,
+                                                  metadata.animation_interval);
+        }
+
+        // Until the plugin assigns a size there is no image to update yet.
+        if (icon->color_icon_size > 0)
+        {
+            queue_image_update (icon);
+        }
+    }
+
+    label_changed = metadata.stable_label != icon->metadata.stable_label ||
+                    g_strcmp0 (metadata.label_template, icon->metadata.label_template) != 0;
+
+    g_strfreev (icon->metadata.animation_frames);
+    g_free (icon->metadata.label_template);
+    icon->metadata = metadata;
+
+    if (label_changed)
+    {
+        refresh_label_mode (icon);
+    }
+}
+
+/* Applies what changed together, so one logical change from the app
+ * costs at most one relayout */
+static void
+apply_property_changes (StatusIcon *icon,
+                        guint       changes)
+{
+    if (changes & CHANGED_METADATA)
+    {
+        load_metadata (icon);
+    }
+
+    if (changes & CHANGED_VISIBLE)
+    {
+        gtk_widget_set_visible (GTK_WIDGET (icon),
+                                xapp_status_icon_interface_get_visible (icon->proxy));
+    }
+
+    if (changes & CHANGED_LABEL)
+    {
+        on_label_changed (icon);
+    }
+
+    if (changes & CHANGED_TOOLTIP)
+    {
+        on_tooltip_changed (icon);
+    }
+
+    if (changes & CHANGED_ICON_NAME)
+    {
+        queue_image_update (icon);
+    }
+}
 
-    dict = json_node_get_object (root);
+static void
+on_proxy_properties_changed (GDBusProxy          *proxy,
+                             GVariant            *changed_properties,
+                             const gchar * const *invalidated_properties,
+                             gpointer             user_data)
+{
+    StatusIcon *icon = STATUS_ICON (user_data);
+    GVariantIter iter;
+    const gchar *name;
+    guint changes = 0;
+    guint i;
 
-    json_object_iter_init (&iter, dict);
+    g_variant_iter_init (&iter, changed_properties);
+
+    while (g_variant_iter_next (&iter, "{&sv}", &name, NULL))
+    {
+        for (i = 0; i < G_N_ELEMENTS (property_changes); i++)
+        {
+            if (g_strcmp0 (name, property_changes[i].name) == 0)
+            {
+                changes |= property_changes[i].change;
+            }
+        }
+    }
 
-    while (json_object_iter_next (&iter, &child_name, &child))
+    for (; invalidated_properties != NULL && *invalidated_properties != NULL; invalidated_properties++)
     {
-        if (g_strcmp0 (child_name, "highlight-both-menus") == 0)
+        for (i = 0; i < G_N_ELEMENTS (property_changes); i++)
         {
-            icon->highlight_both_menus = json_node_get_boolean (child);
+            if (g_strcmp0 (*invalidated_properties, property_changes[i].name) == 0)
+            {
+                changes |= property_changes[i].change;
+            }
         }
     }
+
+    if (changes == 0)
+    {
+        return;
+    }
+
+    icon->pending_changes |= changes;
+    schedule_frame_work (icon);
+}
+
+static void
+count_property_notification (StatusIcon *icon)
+{
+    icon->stats->property_notifications++;
+}
+
+static void
+bind_props_and_signals (StatusIcon *icon)
+{
+    g_signal_connect_swapped (icon->proxy, "notify", G_CALLBACK (count_property_notification), icon);
+    g_signal_connect (icon->proxy, "notify::primary-menu-is-open", G_CALLBACK (menu_visible_changed), icon);
+    g_signal_connect (icon->proxy, "notify::secondary-menu-is-open", G_CALLBACK (menu_visible_changed), icon);
+    // Everything that affects the layout is applied on the next frame, all at once.
+    g_signal_connect (icon->proxy, "g-properties-changed", G_CALLBACK (on_proxy_properties_changed), icon);
+
+    gtk_widget_set_visible (GTK_WIDGET (icon), xapp_status_icon_interface_get_visible (icon->proxy));
+    on_label_changed (icon);
+    on_tooltip_changed (icon);
 }
 
 void
@@ -551,6 +1791,11 @@ status_icon_set_size (StatusIcon *icon,
 {
     g_return_if_fail (STATUS_IS_ICON (icon));
 
+    if (icon->color_icon_size == color_size && icon->symbolic_icon_size == symbolic_size)
+    {
+        return;
+    }
+
     icon->color_icon_size = color_size;
     icon->symbolic_icon_size = symbolic_size;
 
@@ -569,9 +1814,74 @@ status_icon_set_orientation (StatusIcon *icon, GtkPositionType orientation)
 
     icon->orientation = orientation;
 
+    invalidate_proxy_args (icon);
     update_orientation (icon);
 }
 
+/* Limits how often an icon-name change from the app is applied, in
+ * updates per second. Changes are always coalesced to one per frame,
+ * 0 sets no further limit. */
+void
+status_icon_set_max_update_rate (StatusIcon *icon,
+                                 gint        max_rate)
+{
+    g_return_if_fail (STATUS_IS_ICON (icon));
+
+    icon->min_update_interval = max_rate > 0 ? G_USEC_PER_SEC / max_rate : 0;
+}
+
+const StatusIconStats *
+status_icon_get_stats (StatusIcon *icon)
+{
+    g_return_val_if_fail (STATUS_IS_ICON (icon), NULL);
+
+    return icon->stats;
+}
+
+/* Makes the icon count into stats, which must outlive it, or into its own
+ * counters again when stats is NULL */
+void
+status_icon_set_stats (StatusIcon      *icon,
+                       StatusIconStats *stats)
+{
+    g_return_if_fail (STATUS_IS_ICON (icon));
+
+    icon->stats = stats != NULL ? stats : &icon->own_stats;
+}
+
+gboolean
+status_icon_has_image (StatusIcon *icon)
+{
+    g_return_val_if_fail (STATUS_IS_ICON (icon), FALSE);
+
+    return gtk_image_get_storage_type (GTK_IMAGE (icon->image)) != GTK_IMAGE_EMPTY;
+}
+
+/* Labelled icons are wider than the square slot of the others */
+gboolean
+status_icon_has_label (StatusIcon *icon)
+{
+    g_return_val_if_fail (STATUS_IS_ICON (icon), FALSE);
+
+    return label_is_visible (icon);
+}
+
+/* Draws every label at a stable width, regardless of the app's metadata */
+void
+status_icon_set_stable_label (StatusIcon *icon,
+                              gboolean    stable)
+{
+    g_return_if_fail (STATUS_IS_ICON (icon));
+
+    if (icon->stable_label_setting == stable)
+    {
+        return;
+    }
+
+    icon->stable_label_setting = stable;
+    refresh_label_mode (icon);
+}
+
 XAppStatusIconInterface *
 status_icon_get_proxy (StatusIcon *icon)
 {
@@ -581,9 +1891,7 @@ status_icon_get_proxy (StatusIcon *icon)
 }
 
 StatusIcon *
-status_icon_new (XAppStatusIconInterface *proxy,
-                 gint                     color_icon_size,
-                 gint                     symbolic_icon_size)
+status_icon_new (XAppStatusIconInterface *proxy)
 {
     StatusIcon *icon = g_object_new (STATUS_TYPE_ICON, NULL);
     icon->proxy = g_object_ref (proxy);
@@ -593,7 +1901,46 @@ status_icon_new (XAppStatusIconInterface *proxy,
     load_metadata (icon);
 
     update_orientation (icon);
-    status_icon_set_size (icon, color_icon_size, symbolic_icon_size);
+
+    /* The image is loaded once the plugin assigns our size and orientation */
+
+    return icon;
+}
+
+/* A non-interactive stand-in for an icon from the last session, until
+ * status_icon_set_proxy() gives it its app */
+StatusIcon *
+status_icon_new_placeholder (const IconSnapshotEntry *entry)
+{
+    StatusIcon *icon = g_object_new (STATUS_TYPE_ICON, NULL);
+    icon->placeholder = icon_snapshot_entry_copy (entry);
+
+    gtk_widget_show_all (GTK_WIDGET (icon));
+
+    update_orientation (icon);
 
     return icon;
 }
+
+/* The app of a placeholder showed up, it takes over in place */
+void
+status_icon_set_proxy (StatusIcon              *icon,
+                       XAppStatusIconInterface *proxy)
+{
+    g_return_if_fail (STATUS_IS_ICON (icon));
+    g_return_if_fail (icon->proxy == NULL);
+
+    icon->proxy = g_object_ref (proxy);
+    g_clear_pointer (&icon->placeholder, icon_snapshot_entry_free);
+
+    bind_props_and_signals (icon);
+    load_metadata (icon);
+
+    set_label_visible (icon, FALSE);
+    update_orientation (icon);
+
+    if (icon->color_icon_size > 0)
+    {
+        queue_image_update (icon);
+    }
+}
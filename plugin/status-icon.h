@@ -5,6 +5,8 @@
 #include <gtk/gtk.h>
 #include <libxapp/xapp-statusicon-interface.h>
 
+#include "icon-snapshot.h"
+
 G_BEGIN_DECLS
 
 #define STATUS_TYPE_ICON (status_icon_get_type ())
@@ -17,15 +19,39 @@ G_DECLARE_FINAL_TYPE (StatusIcon, status_icon, STATUS, ICON, GtkToggleButton)
 #define ICON_SPACING                5
 #define VISIBLE_LABEL_MARGIN        5 // When an icon has a label, add a margin between icon and label
 
-StatusIcon              *status_icon_new             (XAppStatusIconInterface      *proxy,
-                                                      gint                          color_icon_size,
-                                                      gint                          symbolic_icon_size);
+/* Counters about the work done for an icon, for debugging */
+typedef struct
+{
+    guint  image_updates;
+    guint  decodes;
+    gint64 decode_time; /* Total, in microseconds */
+    guint  cache_hits;
+    guint  property_notifications;
+    guint  button_presses;
+    guint  button_releases;
+    guint  scrolls;
+} StatusIconStats;
+
+StatusIcon              *status_icon_new             (XAppStatusIconInterface      *proxy);
+StatusIcon              *status_icon_new_placeholder (const IconSnapshotEntry      *entry);
+
+void                     status_icon_set_proxy       (StatusIcon                   *icon,
+                                                      XAppStatusIconInterface      *proxy);
 
 void                     status_icon_set_size        (StatusIcon                   *icon,
                                                       gint                          color_icon_size,
                                                       gint                          symbolic_icon_size);
 void                     status_icon_set_orientation (StatusIcon                   *icon,
                                                       GtkPositionType               orientation);
+void                     status_icon_set_max_update_rate (StatusIcon               *icon,
+                                                          gint                      max_rate);
+const StatusIconStats   *status_icon_get_stats       (StatusIcon                   *icon);
+void                     status_icon_set_stats       (StatusIcon                   *icon,
+                                                      StatusIconStats              *stats);
+gboolean                 status_icon_has_image       (StatusIcon                   *icon);
+gboolean                 status_icon_has_label       (StatusIcon                   *icon);
+void                     status_icon_set_stable_label (StatusIcon                  *icon,
+                                                       gboolean                     stable);
 XAppStatusIconInterface *status_icon_get_proxy       (StatusIcon *icon);
 G_END_DECLS
 
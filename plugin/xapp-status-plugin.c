@@ -17,19 +17,38 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <sys/resource.h>
+
 #include <gtk/gtk.h>
 #include <glib/gi18n-lib.h>
 
 #include <libxapp/xapp-statusicon-interface.h>
-#include <libxapp/xapp-status-icon-monitor.h>
 #include <libxfce4panel/xfce-panel-plugin.h>
 
 #include "xapp-status-plugin.h"
 #include "status-icon.h"
+#include "status-icon-box.h"
+#include "icon-entry.h"
+#include "icon-registry.h"
+#include "icon-snapshot.h"
+#include "image-cache.h"
+#include "pixel-cache.h"
+#include "debug-statistics.h"
+#include "profiling.h"
 
 #define SETTINGS_SCHEMA "org.x.apps.xfce4-status-plugin"
 #define KEY_COLOR_ICON_SIZE "color-icon-size"
 #define KEY_SYMBOLIC_ICON_SIZE "symbolic-icon-size"
+#define KEY_IMAGE_CACHE_SIZE "image-cache-size"
+#define KEY_MAX_ICON_UPDATE_RATE "max-icon-update-rate"
+#define KEY_DEBUG_STATISTICS "debug-statistics"
+#define KEY_MAX_INLINE_ICONS "max-inline-icons"
+#define KEY_STABLE_LABEL_WIDTH "stable-label-width"
+
+/* How long placeholders from the last session wait for their app, in seconds */
+#define PLACEHOLDER_TIMEOUT 30
+/* Delay before saving the snapshot, so a burst of new icons is saved once */
+#define SNAPSHOT_SAVE_DELAY 5
 
 struct _XAppStatusPluginClass
 {
@@ -40,20 +59,64 @@ struct _XAppStatusPlugin
 {
   XfcePanelPlugin __parent__;
 
-  /* dbus monitor */
-  XAppStatusIconMonitor *monitor;
+  /* Shared with the other instances in the process */
+  IconRegistry *registry;
 
-  /* A quick reference to our list box items */
+  /* Every icon's IconEntry, by its key */
   GHashTable *lookup_table;
 
-  /* A GtkListBox to hold our icons */
+  /* Entries in display order */
+  GSequence *icon_order;
+
+  /* A StatusIconBox to hold our icons */
   GtkWidget *icon_box;
 
+  /* Holds icon_box and the overflow button */
+  GtkWidget *main_box;
+
+  /* Icons that don't fit inline only have an IconEntry. They get a widget
+   * in overflow_box while the popover is open. max_inline_icons is a count,
+   * 0 for no limit, or -1 to fit as many as the panel gives us room for. */
+  gint max_inline_icons;
+  gboolean overflow_dirty;
+  gint allocated_length; /* Of the plugin along the panel, in fit mode */
+  gint inline_length; /* Requested by icon_box, after the last overflow pass */
+  GtkWidget *overflow_button;
+  GtkWidget *overflow_popover;
+  GtkWidget *overflow_box;
+
   GSettings *settings;
+
+  /* Icon sizes resolved from the settings and the panel size */
+  gint color_icon_size;
+  gint symbolic_icon_size;
+
+  gint max_update_rate;
+  gboolean stable_label_width;
+
+  /* Runtime counters, exported on the bus when debug-statistics is set */
+  guint sort_passes;
+  guint layout_passes;
+  guint size_passes;
+  DebugStatistics *debug_statistics;
+
+  /* Startup measurement, enabled by XAPP_STATUS_PLUGIN_BENCHMARK=<number of icons> */
+  gint64 construct_time;
+  guint benchmark_target;
+  guint benchmark_drawn;
+
+  /* Icons given a widget since the last layout pass */
+  GList *pending_icons;
+  guint layout_idle_id;
+
+  guint placeholder_timeout_id;
+  guint snapshot_save_id;
 };
 
-/* define the plugin */
-XFCE_PANEL_DEFINE_PLUGIN (XAppStatusPlugin, xapp_status_plugin)
+/* define the plugin. It runs inside the panel, so every instance shares the
+ * IconRegistry, and the decode threads and the caches' sources must never
+ * outlive an unloaded module. */
+XFCE_PANEL_DEFINE_PLUGIN_RESIDENT (XAppStatusPlugin, xapp_status_plugin)
 
 static gboolean xapp_status_plugin_size_changed (XfcePanelPlugin *panel_plugin,
                                                         gint             size);
@@ -61,179 +124,684 @@ static void     xapp_status_plugin_screen_position_changed (XfcePanelPlugin   *p
                                                                    XfceScreenPosition position);
 static gint     get_color_icon_size (XAppStatusPlugin *plugin);
 static gint     get_symbolic_icon_size (XAppStatusPlugin *plugin);
+static GtkPositionType get_icon_orientation (XfceScreenPosition position);
+static void     queue_layout (XAppStatusPlugin *plugin);
 
 
 static void
 xapp_status_plugin_init (XAppStatusPlugin *plugin)
 {
-  plugin->monitor = NULL;
-  plugin->lookup_table = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                g_free, NULL);
+  plugin->registry = NULL;
+  /* The entries own their keys */
+  plugin->lookup_table = g_hash_table_new (g_str_hash, g_str_equal);
+  plugin->icon_order = g_sequence_new (NULL);
+}
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b,
+                 gpointer      user_data)
+{
+    return icon_entry_compare (a, b);
+}
+
+/* Whether some icons may not be inline, so the layout pass decides where
+ * each one goes */
+static gboolean
+has_overflow (XAppStatusPlugin *plugin)
+{
+    return plugin->max_inline_icons != 0 || plugin->overflow_dirty;
+}
+
+static void
+place_icon (XAppStatusPlugin *plugin,
+            IconEntry        *entry)
+{
+    plugin->sort_passes++;
+
+    PROFILE_BEGIN (profile_begin);
+
+    if (entry->iter == NULL)
+    {
+        entry->iter = g_sequence_insert_sorted (plugin->icon_order, entry, compare_entries, NULL);
+    }
+    else
+    {
+        g_sequence_sort_changed (entry->iter, compare_entries, NULL);
+    }
+
+    // Which icons overflow depends on the whole order, let the layout pass sort it out.
+    if (has_overflow (plugin))
+    {
+        plugin->overflow_dirty = TRUE;
+        queue_layout (plugin);
+
+        PROFILE_END (profile_begin, "sort-icons", NULL);
+        return;
+    }
+
+    // Without overflow every entry has its widget in icon_box.
+    status_icon_box_reorder (STATUS_ICON_BOX (plugin->icon_box),
+                             GTK_WIDGET (entry->icon),
+                             g_sequence_iter_get_position (entry->iter));
+
+    PROFILE_END (profile_begin, "sort-icons", NULL);
 }
 
-static gchar *
-get_unique_key (GDBusProxy *proxy)
+static void
+unplace_icon (XAppStatusPlugin *plugin,
+              IconEntry        *entry)
 {
-    const gchar *name = xapp_status_icon_interface_get_name (XAPP_STATUS_ICON_INTERFACE (proxy));
-    const gchar *path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (proxy));
+    if (entry->iter == NULL)
+    {
+        return;
+    }
+
+    g_sequence_remove (entry->iter);
+    entry->iter = NULL;
+}
 
-    return g_strconcat (name, path, NULL);
+/* A new name or icon name, or the icon was shown or hidden */
+static void
+on_entry_changed (IconEntry *entry,
+                  gpointer   user_data)
+{
+    place_icon (XAPP_STATUS_PLUGIN (user_data), entry);
 }
 
 static gint
-compare_icons (gpointer a,
-               gpointer b)
+get_slot_size (XAppStatusPlugin *plugin)
+{
+    XfcePanelPlugin *panel_plugin = XFCE_PANEL_PLUGIN (plugin);
+
+    return xfce_panel_plugin_get_size (panel_plugin) / xfce_panel_plugin_get_nrows (panel_plugin);
+}
+
+static gboolean on_benchmark_icon_draw (GtkWidget *widget,
+                                        cairo_t   *cr,
+                                        gpointer   user_data);
+
+/* Gives the entry its widget, sized in the next layout pass */
+static void
+create_icon (XAppStatusPlugin *plugin,
+             IconEntry        *entry)
 {
-    XAppStatusIconInterface *proxy_a, *proxy_b;
-    gboolean sym_a, sym_b;
-    gint res;
+    StatusIcon *icon;
+
+    if (entry->proxy != NULL)
+    {
+        icon = status_icon_new (entry->proxy);
+    }
+    else
+    {
+        icon = status_icon_new_placeholder (entry->placeholder);
+    }
+
+    // The entry keeps its own reference, the widget moves between boxes.
+    entry->icon = g_object_ref_sink (icon);
+
+    // Overflowed icons get a new widget each time the popover opens, keep counting where the last one stopped.
+    status_icon_set_stats (icon, &entry->stats);
+
+    status_icon_set_max_update_rate (icon, plugin->max_update_rate);
+    status_icon_set_stable_label (icon, plugin->stable_label_width);
+
+    if (plugin->benchmark_target > 0)
+    {
+        g_signal_connect_after (icon, "draw", G_CALLBACK (on_benchmark_icon_draw), plugin);
+    }
+
+    plugin->pending_icons = g_list_prepend (plugin->pending_icons, icon);
+    queue_layout (plugin);
+}
+
+static void
+destroy_icon (XAppStatusPlugin *plugin,
+              IconEntry        *entry)
+{
+    GtkWidget *widget;
+
+    if (entry->icon == NULL)
+    {
+        return;
+    }
+
+    widget = GTK_WIDGET (entry->icon);
+
+    plugin->pending_icons = g_list_remove (plugin->pending_icons, entry->icon);
+
+    if (gtk_widget_get_parent (widget) != NULL)
+    {
+        gtk_container_remove (GTK_CONTAINER (gtk_widget_get_parent (widget)), widget);
+    }
+
+    // Whatever still holds the widget must not count into a freed entry.
+    status_icon_set_stats (entry->icon, NULL);
+
+    // Disconnects the icon from its proxy
+    gtk_widget_destroy (widget);
+    g_clear_object (&entry->icon);
+}
+
+static void
+move_icon (StatusIcon *icon,
+           GtkWidget  *box,
+           gint        position)
+{
+    GtkWidget *widget = GTK_WIDGET (icon);
+    GtkWidget *parent = gtk_widget_get_parent (widget);
+
+    if (parent != box)
+    {
+        if (parent != NULL)
+        {
+            gtk_container_remove (GTK_CONTAINER (parent), widget);
+        }
+
+        gtk_container_add (GTK_CONTAINER (box), widget);
+    }
+
+    status_icon_box_reorder (STATUS_ICON_BOX (box), widget, position);
+}
+
+static gboolean
+is_horizontal (XAppStatusPlugin *plugin)
+{
+    return xfce_panel_plugin_get_orientation (XFCE_PANEL_PLUGIN (plugin)) == GTK_ORIENTATION_HORIZONTAL;
+}
+
+/* The room an entry takes inline: measured when it has a widget, otherwise
+ * what it took the last time it had one, or a slot. */
+static gint
+get_entry_length (XAppStatusPlugin *plugin,
+                  IconEntry        *entry)
+{
+    if (entry->icon != NULL)
+    {
+        entry->length = status_icon_box_get_child_length (STATUS_ICON_BOX (plugin->icon_box),
+                                                          GTK_WIDGET (entry->icon));
+    }
+
+    return entry->length > 0 ? entry->length : get_slot_size (plugin);
+}
+
+/* How much of the panel the visible icons may use in fit mode, or G_MAXINT
+ * when they all fit */
+static gint
+get_inline_room (XAppStatusPlugin *plugin)
+{
+    GSequenceIter *iter;
+    gint room, total = 0;
+
+    // Not allocated yet, don't overflow them all for a frame.
+    if (plugin->allocated_length <= 0)
+    {
+        return G_MAXINT;
+    }
+
+    room = plugin->allocated_length - 2 * gtk_container_get_border_width (GTK_CONTAINER (plugin->icon_box));
+
+    for (iter = g_sequence_get_begin_iter (plugin->icon_order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter))
+    {
+        IconEntry *entry = g_sequence_get (iter);
 
-    proxy_a = status_icon_get_proxy (STATUS_ICON (a));
-    proxy_b = status_icon_get_proxy (STATUS_ICON (b));
+        if (entry->visible)
+        {
+            total += get_entry_length (plugin, entry);
+        }
+    }
+
+    if (total <= room)
+    {
+        return G_MAXINT;
+    }
+
+    // Some will overflow, keep room for the button.
+    return room - get_slot_size (plugin);
+}
+
+static void close_overflow_popover (XAppStatusPlugin *plugin);
 
-    sym_a = g_strstr_len (xapp_status_icon_interface_get_icon_name (proxy_a), -1, "symbolic") != NULL;
-    sym_b = g_strstr_len (xapp_status_icon_interface_get_icon_name (proxy_b), -1, "symbolic") != NULL;
+/* Decides which entries are inline. Only those, and the overflowed ones
+ * while the popover is open, have a widget. Without a limit every entry
+ * keeps one, hidden icons included, otherwise hidden entries have none
+ * either until they are shown. */
+static void
+update_overflow (XAppStatusPlugin *plugin)
+{
+    GSequenceIter *iter;
+    gint n_inline = 0, n_visible = 0, n_overflow = 0;
+    gint room = G_MAXINT, used = 0;
 
-    if (sym_a && !sym_b)
+    plugin->overflow_dirty = FALSE;
+
+    if (plugin->max_inline_icons < 0)
     {
-        return 1;
+        room = get_inline_room (plugin);
     }
 
-    if (sym_b && !sym_a)
+    for (iter = g_sequence_get_begin_iter (plugin->icon_order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter))
     {
-        return -1;
+        IconEntry *entry = g_sequence_get (iter);
+        gboolean fits;
+
+        if (plugin->max_inline_icons == 0)
+        {
+            fits = TRUE;
+        }
+        else
+        if (!entry->visible)
+        {
+            destroy_icon (plugin, entry);
+            continue;
+        }
+        else
+        if (plugin->max_inline_icons > 0)
+        {
+            fits = n_visible < plugin->max_inline_icons;
+        }
+        else
+        {
+            // Once one icon doesn't fit, the ones after it go too, to keep the order.
+            fits = n_overflow == 0 && used + get_entry_length (plugin, entry) <= room;
+            used += fits ? get_entry_length (plugin, entry) : 0;
+        }
+
+        if (entry->visible)
+        {
+            n_visible++;
+        }
+
+        if (fits)
+        {
+            if (entry->icon == NULL)
+            {
+                create_icon (plugin, entry);
+            }
+
+            move_icon (entry->icon, plugin->icon_box, n_inline++);
+        }
+        else
+        if (plugin->overflow_box != NULL)
+        {
+            if (entry->icon == NULL)
+            {
+                create_icon (plugin, entry);
+            }
+
+            move_icon (entry->icon, plugin->overflow_box, n_overflow++);
+        }
+        else
+        {
+            // Only the entry is left while the popover is closed.
+            destroy_icon (plugin, entry);
+            n_overflow++;
+        }
     }
 
-    res = g_utf8_collate (xapp_status_icon_interface_get_name (proxy_a),
-                          xapp_status_icon_interface_get_name (proxy_b));
+    gtk_widget_set_visible (plugin->overflow_button, n_overflow > 0);
 
-    if (res != 0)
+    if (n_overflow == 0)
     {
-        return res;
+        close_overflow_popover (plugin);
     }
+}
+
+static void
+close_overflow_popover (XAppStatusPlugin *plugin)
+{
+    GtkWidget *popover = plugin->overflow_popover;
 
-    gchar *key_a, *key_b;
+    if (popover == NULL)
+    {
+        return;
+    }
 
-    key_a = get_unique_key (G_DBUS_PROXY (proxy_a));
-    key_b = get_unique_key (G_DBUS_PROXY (proxy_b));
+    plugin->overflow_popover = NULL;
+    plugin->overflow_box = NULL;
 
-    res = g_utf8_collate (key_a, key_b);
+    // Drop the overflowed icons' widgets before the box goes away.
+    update_overflow (plugin);
 
-    g_free (key_a);
-    g_free (key_b);
+    gtk_widget_destroy (popover);
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (plugin->overflow_button), FALSE);
+}
 
-    return res;
+static void
+on_overflow_popover_closed (GtkPopover *popover,
+                            gpointer    user_data)
+{
+    close_overflow_popover (XAPP_STATUS_PLUGIN (user_data));
 }
 
 static void
-sort_icons (XAppStatusPlugin *plugin)
+on_overflow_button_toggled (GtkToggleButton *button,
+                            gpointer         user_data)
 {
-    GList *unordered_icons, *icons, *iter;
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
 
-    unordered_icons = g_hash_table_get_values (plugin->lookup_table);
+    if (!gtk_toggle_button_get_active (button))
+    {
+        close_overflow_popover (plugin);
+        return;
+    }
 
-    if (!unordered_icons)
+    if (plugin->overflow_popover != NULL)
     {
         return;
     }
 
-    icons = g_list_copy (unordered_icons);
-    icons = g_list_sort (icons, (GCompareFunc) compare_icons);
-    icons = g_list_reverse (icons);
+    plugin->overflow_popover = gtk_popover_new (GTK_WIDGET (button));
+    g_signal_connect (plugin->overflow_popover, "closed", G_CALLBACK (on_overflow_popover_closed), plugin);
+
+    plugin->overflow_box = status_icon_box_new (GTK_ORIENTATION_VERTICAL);
+    status_icon_box_set_slot_size (STATUS_ICON_BOX (plugin->overflow_box), get_slot_size (plugin));
+    gtk_container_set_border_width (GTK_CONTAINER (plugin->overflow_box), INDICATOR_BOX_BORDER);
+    gtk_container_add (GTK_CONTAINER (plugin->overflow_popover), plugin->overflow_box);
+
+    // The overflowed icons get their widgets, only for as long as the popover is open.
+    update_overflow (plugin);
+
+    gtk_widget_show (plugin->overflow_box);
+    gtk_widget_show (plugin->overflow_popover);
+}
+
+static gboolean
+on_benchmark_icon_draw (GtkWidget *widget,
+                        cairo_t   *cr,
+                        gpointer   user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    struct rusage usage;
+
+    if (!status_icon_has_image (STATUS_ICON (widget)))
+    {
+        return GDK_EVENT_PROPAGATE;
+    }
+
+    g_signal_handlers_disconnect_by_func (widget, on_benchmark_icon_draw, user_data);
+
+    if (++plugin->benchmark_drawn != plugin->benchmark_target)
+    {
+        return GDK_EVENT_PROPAGATE;
+    }
+
+    getrusage (RUSAGE_SELF, &usage);
+
+    g_message ("Benchmark: %u icons drawn %.1f ms after construction, peak RSS %ld KiB",
+               plugin->benchmark_drawn,
+               (g_get_monotonic_time () - plugin->construct_time) / 1000.0,
+               usage.ru_maxrss);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static gboolean
+layout_idle_cb (gpointer user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    XfcePanelPlugin *panel_plugin = XFCE_PANEL_PLUGIN (plugin);
+    GtkPositionType orientation;
+    GList *iter;
+
+    plugin->layout_idle_id = 0;
+    plugin->layout_passes++;
 
-    iter = icons;
+    PROFILE_BEGIN (profile_begin);
 
-    while (iter)
+    orientation = get_icon_orientation (xfce_panel_plugin_get_screen_position (panel_plugin));
+
+    if (plugin->overflow_dirty)
+    {
+        update_overflow (plugin);
+    }
+
+    // Only the icons that arrived since the last pass need sizing, the others are up to date.
+    // The icon box lays them out on its own, adding them already queued its resize.
+    for (iter = plugin->pending_icons; iter != NULL; iter = iter->next)
     {
         StatusIcon *icon = STATUS_ICON (iter->data);
 
-        gtk_box_reorder_child (GTK_BOX (plugin->icon_box),
-                               GTK_WIDGET (icon),
-                               0);
+        // Hidden icons only record these, their image is loaded once shown.
+        status_icon_set_orientation (icon, orientation);
+        status_icon_set_size (icon,
+                              plugin->color_icon_size,
+                              plugin->symbolic_icon_size);
+    }
+
+    g_clear_pointer (&plugin->pending_icons, g_list_free);
 
-        iter = iter->next;
+    PROFILE_END (profile_begin, "layout-pass", NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+queue_layout (XAppStatusPlugin *plugin)
+{
+    if (plugin->layout_idle_id > 0)
+    {
+        return;
     }
 
-    g_list_free (icons);
+    // Run before GTK's resize and redraw so new icons never show up unsized.
+    plugin->layout_idle_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                              layout_idle_cb,
+                                              plugin,
+                                              NULL);
+}
+
+static gboolean
+save_snapshot_cb (gpointer user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    GSequenceIter *iter;
+    GList *entries = NULL;
+
+    plugin->snapshot_save_id = 0;
+
+    for (iter = g_sequence_get_begin_iter (plugin->icon_order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter))
+    {
+        IconEntry *entry = g_sequence_get (iter);
+
+        if (entry->visible)
+        {
+            entries = g_list_prepend (entries, icon_entry_get_snapshot (entry));
+        }
+    }
+
+    entries = g_list_reverse (entries);
+
+    icon_snapshot_save (xfce_panel_plugin_get_unique_id (XFCE_PANEL_PLUGIN (plugin)), entries);
+
+    g_list_free_full (entries, (GDestroyNotify) icon_snapshot_entry_free);
+
+    return G_SOURCE_REMOVE;
 }
 
+/* Only arrivals save the snapshot. At logout the apps often quit before the
+ * panel does, and their removal shouldn't empty the next session's one. */
 static void
-on_icon_added (XAppStatusIconMonitor        *monitor,
+queue_snapshot_save (XAppStatusPlugin *plugin)
+{
+    if (plugin->snapshot_save_id > 0)
+    {
+        return;
+    }
+
+    plugin->snapshot_save_id = g_timeout_add_seconds (SNAPSHOT_SAVE_DELAY, save_snapshot_cb, plugin);
+}
+
+static void
+add_icon (XAppStatusPlugin *plugin,
+          IconEntry        *entry)
+{
+    g_hash_table_insert (plugin->lookup_table,
+                         entry->key,
+                         entry);
+
+    // Without overflow every icon is inline, give it its widget right away.
+    if (!has_overflow (plugin))
+    {
+        create_icon (plugin, entry);
+        gtk_container_add (GTK_CONTAINER (plugin->icon_box),
+                           GTK_WIDGET (entry->icon));
+    }
+
+    place_icon (plugin, entry);
+}
+
+static void
+on_icon_added (IconRegistry                 *registry,
                XAppStatusIconInterface      *proxy,
                gpointer                      user_data)
 {
     XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
-    XfcePanelPlugin *panel_plugin = XFCE_PANEL_PLUGIN (plugin);
-    StatusIcon *icon;
+    IconEntry *entry;
     gchar *key;
 
-    key = get_unique_key (G_DBUS_PROXY (proxy));
-    icon = g_hash_table_lookup (plugin->lookup_table,
-                                key);
+    key = icon_entry_make_key (proxy);
+    entry = g_hash_table_lookup (plugin->lookup_table,
+                                 key);
+    g_free (key);
 
-    if (icon)
+    if (entry)
     {
+        // A placeholder from the last session becomes the live icon, without moving.
+        if (entry->proxy == NULL)
+        {
+            icon_entry_set_proxy (entry, proxy);
+
+            if (entry->icon != NULL)
+            {
+                status_icon_set_proxy (entry->icon, proxy);
+            }
+
+            place_icon (plugin, entry);
+            queue_snapshot_save (plugin);
+        }
+
         // Or should we remove the existing one and add this one??
         return;
     }
 
-    icon = status_icon_new (proxy,
-                            get_color_icon_size (plugin),
-                            get_symbolic_icon_size (plugin));
+    add_icon (plugin, icon_entry_new (proxy, on_entry_changed, plugin));
+    queue_snapshot_save (plugin);
+}
 
-    gtk_container_add (GTK_CONTAINER (plugin->icon_box),
-                       GTK_WIDGET (icon));
+static void
+remove_icon (XAppStatusPlugin *plugin,
+             const gchar      *key)
+{
+    IconEntry *entry;
 
-    g_hash_table_insert (plugin->lookup_table,
-                         g_strdup (key),
-                         icon);
+    entry = g_hash_table_lookup (plugin->lookup_table,
+                                 key);
 
-    g_free (key);
+    if (!entry)
+    {
+        return;
+    }
 
-    g_signal_connect_swapped (icon, "re-sort", G_CALLBACK (sort_icons), plugin);
-    sort_icons (plugin);
+    // Removing a child keeps the remaining ones in order, and the box queues its own resize.
+    destroy_icon (plugin, entry);
+    unplace_icon (plugin, entry);
 
-    xapp_status_plugin_size_changed (panel_plugin,
-                                     xfce_panel_plugin_get_size (panel_plugin));
+    // An inline spot may have opened up for an overflowed icon.
+    if (has_overflow (plugin))
+    {
+        plugin->overflow_dirty = TRUE;
+        queue_layout (plugin);
+    }
 
-    xapp_status_plugin_screen_position_changed (panel_plugin,
-                                                xfce_panel_plugin_get_screen_position (panel_plugin));
+    g_hash_table_remove (plugin->lookup_table,
+                         key);
+    icon_entry_free (entry);
 }
 
 static void
-on_icon_removed (XAppStatusIconMonitor        *monitor,
+on_icon_removed (IconRegistry                 *registry,
                  XAppStatusIconInterface      *proxy,
                  gpointer                      user_data)
 {
-    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
-    XfcePanelPlugin *panel_plugin = XFCE_PANEL_PLUGIN (plugin);
-    StatusIcon *icon;
     gchar *key;
 
-    key = get_unique_key (G_DBUS_PROXY (proxy));
-    icon = g_hash_table_lookup (plugin->lookup_table,
-                                key);
+    key = icon_entry_make_key (proxy);
+    remove_icon (XAPP_STATUS_PLUGIN (user_data), key);
+
+    g_free (key);
+}
+
+static gboolean
+drop_placeholders_cb (gpointer user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    GHashTableIter iter;
+    gpointer key, value;
+    GList *keys = NULL, *l;
+
+    plugin->placeholder_timeout_id = 0;
 
-    if (!icon)
+    g_hash_table_iter_init (&iter, plugin->lookup_table);
+
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-        return;
+        if (((IconEntry *) value)->proxy == NULL)
+        {
+            keys = g_list_prepend (keys, g_strdup (key));
+        }
     }
 
-    gtk_container_remove (GTK_CONTAINER (plugin->icon_box),
-                          GTK_WIDGET (icon));
+    for (l = keys; l != NULL; l = l->next)
+    {
+        remove_icon (plugin, l->data);
+    }
 
-    g_hash_table_remove (plugin->lookup_table,
-                         key);
+    // Their apps are gone, forget them for the next session too.
+    if (keys != NULL)
+    {
+        queue_snapshot_save (plugin);
+    }
 
-    g_free (key);
+    g_list_free_full (keys, g_free);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Fills the panel with the last session's icons before any app is found */
+static void
+load_placeholders (XAppStatusPlugin *plugin)
+{
+    GList *entries, *l;
+
+    entries = icon_snapshot_load (xfce_panel_plugin_get_unique_id (XFCE_PANEL_PLUGIN (plugin)));
+
+    if (entries == NULL)
+    {
+        return;
+    }
+
+    for (l = entries; l != NULL; l = l->next)
+    {
+        IconSnapshotEntry *snapshot = l->data;
+
+        if (g_hash_table_contains (plugin->lookup_table, snapshot->key))
+        {
+            continue;
+        }
 
-    sort_icons (plugin);
+        add_icon (plugin, icon_entry_new_placeholder (snapshot, on_entry_changed, plugin));
+    }
 
-    xapp_status_plugin_size_changed (XFCE_PANEL_PLUGIN (plugin),
-                                            xfce_panel_plugin_get_size (panel_plugin));
+    g_list_free_full (entries, (GDestroyNotify) icon_snapshot_entry_free);
 
-    xapp_status_plugin_screen_position_changed (XFCE_PANEL_PLUGIN (plugin),
-                                                       xfce_panel_plugin_get_screen_position (panel_plugin));
+    plugin->placeholder_timeout_id = g_timeout_add_seconds (PLACEHOLDER_TIMEOUT, drop_placeholders_cb, plugin);
 }
 
 static void
@@ -299,32 +867,259 @@ get_symbolic_icon_size (XAppStatusPlugin *plugin)
 }
 
 static void
-xapp_status_plugin_construct (XfcePanelPlugin *panel_plugin)
+update_icon_sizes (XAppStatusPlugin *plugin)
 {
-    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (panel_plugin);
+    plugin->color_icon_size = get_color_icon_size (plugin);
+    plugin->symbolic_icon_size = get_symbolic_icon_size (plugin);
+}
 
-    plugin->monitor = xapp_status_icon_monitor_new ();
+static void
+on_icon_size_setting_changed (GSettings   *settings,
+                              const gchar *key,
+                              gpointer     user_data)
+{
+    XfcePanelPlugin *panel_plugin = XFCE_PANEL_PLUGIN (user_data);
 
-    g_signal_connect (plugin->monitor,
-                      "icon-added",
-                      G_CALLBACK (on_icon_added),
-                      plugin);
+    xapp_status_plugin_size_changed (panel_plugin,
+                                     xfce_panel_plugin_get_size (panel_plugin));
+}
 
+static void
+on_max_update_rate_changed (GSettings   *settings,
+                            const gchar *key,
+                            gpointer     user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    GHashTableIter iter;
+    gpointer hkey, value;
 
-    g_signal_connect (plugin->monitor,
-                      "icon-removed",
-                      G_CALLBACK (on_icon_removed),
-                      plugin);
+    plugin->max_update_rate = g_settings_get_int (settings, KEY_MAX_ICON_UPDATE_RATE);
 
-    plugin->icon_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL,
-                                    0);
+    g_hash_table_iter_init (&iter, plugin->lookup_table);
+
+    while (g_hash_table_iter_next (&iter, &hkey, &value))
+    {
+        IconEntry *entry = value;
+
+        // Icons without a widget pick it up when they get one.
+        if (entry->icon != NULL)
+        {
+            status_icon_set_max_update_rate (entry->icon, plugin->max_update_rate);
+        }
+    }
+}
+
+static void
+on_stable_label_width_changed (GSettings   *settings,
+                               const gchar *key,
+                               gpointer     user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    GHashTableIter iter;
+    gpointer hkey, value;
+
+    plugin->stable_label_width = g_settings_get_boolean (settings, KEY_STABLE_LABEL_WIDTH);
+
+    g_hash_table_iter_init (&iter, plugin->lookup_table);
+
+    while (g_hash_table_iter_next (&iter, &hkey, &value))
+    {
+        IconEntry *entry = value;
+
+        // Icons without a widget pick it up when they get one.
+        if (entry->icon != NULL)
+        {
+            status_icon_set_stable_label (entry->icon, plugin->stable_label_width);
+        }
+    }
+}
+
+static GVariant *
+build_statistics (gpointer user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+    GVariantBuilder plugin_builder, icons_builder;
+    GHashTableIter iter;
+    gpointer key, value;
+    guint n_widgets = 0;
+
+    g_variant_builder_init (&icons_builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+
+    g_hash_table_iter_init (&iter, plugin->lookup_table);
+
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        IconEntry *entry = value;
+        const StatusIconStats *stats = &entry->stats;
+
+        // Overflowed icons only have their entry while the popover is closed, their counts stay on it.
+        if (entry->icon != NULL)
+        {
+            n_widgets++;
+        }
+
+        g_variant_builder_open (&icons_builder, G_VARIANT_TYPE ("{sa{sv}}"));
+        g_variant_builder_add (&icons_builder, "s", (const gchar *) key);
+        g_variant_builder_open (&icons_builder, G_VARIANT_TYPE_VARDICT);
+
+        g_variant_builder_add (&icons_builder, "{sv}", "image-updates", g_variant_new_uint32 (stats->image_updates));
+        g_variant_builder_add (&icons_builder, "{sv}", "decodes", g_variant_new_uint32 (stats->decodes));
+        g_variant_builder_add (&icons_builder, "{sv}", "decode-time-us", g_variant_new_int64 (stats->decode_time));
+        g_variant_builder_add (&icons_builder, "{sv}", "cache-hits", g_variant_new_uint32 (stats->cache_hits));
+        g_variant_builder_add (&icons_builder, "{sv}", "property-notifications", g_variant_new_uint32 (stats->property_notifications));
+        g_variant_builder_add (&icons_builder, "{sv}", "button-presses", g_variant_new_uint32 (stats->button_presses));
+        g_variant_builder_add (&icons_builder, "{sv}", "button-releases", g_variant_new_uint32 (stats->button_releases));
+        g_variant_builder_add (&icons_builder, "{sv}", "scrolls", g_variant_new_uint32 (stats->scrolls));
+
+        g_variant_builder_close (&icons_builder);
+        g_variant_builder_close (&icons_builder);
+    }
+
+    g_variant_builder_init (&plugin_builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&plugin_builder, "{sv}", "icons", g_variant_new_uint32 (g_hash_table_size (plugin->lookup_table)));
+    g_variant_builder_add (&plugin_builder, "{sv}", "icon-widgets", g_variant_new_uint32 (n_widgets));
+    g_variant_builder_add (&plugin_builder, "{sv}", "sort-passes", g_variant_new_uint32 (plugin->sort_passes));
+    g_variant_builder_add (&plugin_builder, "{sv}", "layout-passes", g_variant_new_uint32 (plugin->layout_passes));
+    g_variant_builder_add (&plugin_builder, "{sv}", "size-passes", g_variant_new_uint32 (plugin->size_passes));
+
+    return g_variant_new ("(a{sv}a{sa{sv}})", &plugin_builder, &icons_builder);
+}
+
+static void
+on_debug_statistics_changed (GSettings   *settings,
+                             const gchar *key,
+                             gpointer     user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+
+    if (!g_settings_get_boolean (settings, KEY_DEBUG_STATISTICS))
+    {
+        g_clear_pointer (&plugin->debug_statistics, debug_statistics_free);
+        return;
+    }
+
+    if (plugin->debug_statistics == NULL)
+    {
+        plugin->debug_statistics = debug_statistics_new (xfce_panel_plugin_get_unique_id (XFCE_PANEL_PLUGIN (plugin)),
+                                                         build_statistics,
+                                                         plugin);
+    }
+}
+
+static void
+on_image_cache_size_changed (GSettings   *settings,
+                             const gchar *key,
+                             gpointer     user_data)
+{
+    gint size = g_settings_get_int (settings, KEY_IMAGE_CACHE_SIZE);
+
+    image_cache_set_max_size ((gsize) MAX (size, 0) * 1024);
+}
+
+static void
+on_max_inline_icons_changed (GSettings   *settings,
+                             const gchar *key,
+                             gpointer     user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (user_data);
+
+    plugin->max_inline_icons = g_settings_get_int (settings, KEY_MAX_INLINE_ICONS);
+
+    // To fit the icons to the panel, take all the room it has, but give it back when it runs short.
+    xfce_panel_plugin_set_expand (XFCE_PANEL_PLUGIN (plugin), plugin->max_inline_icons < 0);
+    xfce_panel_plugin_set_shrink (XFCE_PANEL_PLUGIN (plugin), plugin->max_inline_icons < 0);
+
+    plugin->overflow_dirty = TRUE;
+    queue_layout (plugin);
+}
+
+static gint
+get_length (XAppStatusPlugin *plugin,
+            GtkAllocation    *allocation)
+{
+    return is_horizontal (plugin) ? allocation->width : allocation->height;
+}
+
+/* In fit mode, which icons fit changes with the room the panel gives us,
+ * and with the room the inline ones ask for. */
+static void
+on_plugin_size_allocate (GtkWidget     *widget,
+                         GtkAllocation *allocation,
+                         gpointer       user_data)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (widget);
+    GtkAllocation box_allocation;
+    gint length, inline_length;
+
+    if (plugin->max_inline_icons >= 0)
+    {
+        return;
+    }
+
+    gtk_widget_get_allocation (plugin->icon_box, &box_allocation);
+
+    length = get_length (plugin, allocation);
+    inline_length = get_length (plugin, &box_allocation);
+
+    if (length == plugin->allocated_length && inline_length == plugin->inline_length)
+    {
+        return;
+    }
+
+    plugin->allocated_length = length;
+    plugin->inline_length = inline_length;
+    plugin->overflow_dirty = TRUE;
+    queue_layout (plugin);
+}
+
+static void
+xapp_status_plugin_construct (XfcePanelPlugin *panel_plugin)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (panel_plugin);
+    const gchar *benchmark;
+    GList *icons, *l;
+
+    benchmark = g_getenv ("XAPP_STATUS_PLUGIN_BENCHMARK");
+
+    if (benchmark != NULL)
+    {
+        plugin->benchmark_target = (guint) g_ascii_strtoull (benchmark, NULL, 10);
+        plugin->construct_time = g_get_monotonic_time ();
+    }
+
+    plugin->icon_box = status_icon_box_new (GTK_ORIENTATION_HORIZONTAL);
 
     gtk_widget_show (plugin->icon_box);
     gtk_container_set_border_width (GTK_CONTAINER (plugin->icon_box),
                                     INDICATOR_BOX_BORDER);
 
+    plugin->main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL,
+                                    0);
+    gtk_box_pack_start (GTK_BOX (plugin->main_box), plugin->icon_box, FALSE, FALSE, 0);
+
+    plugin->overflow_button = gtk_toggle_button_new ();
+    gtk_button_set_relief (GTK_BUTTON (plugin->overflow_button), GTK_RELIEF_NONE);
+    gtk_widget_set_focus_on_click (plugin->overflow_button, FALSE);
+    gtk_container_add (GTK_CONTAINER (plugin->overflow_button),
+                       gtk_image_new_from_icon_name ("view-more-symbolic", GTK_ICON_SIZE_MENU));
+    gtk_widget_set_tooltip_text (plugin->overflow_button, _("More status icons"));
+    gtk_widget_set_no_show_all (plugin->overflow_button, TRUE);
+    gtk_widget_show_all (gtk_bin_get_child (GTK_BIN (plugin->overflow_button)));
+    gtk_box_pack_start (GTK_BOX (plugin->main_box), plugin->overflow_button, FALSE, FALSE, 0);
+    xfce_panel_plugin_add_action_widget (panel_plugin, plugin->overflow_button);
+
+    g_signal_connect (plugin->overflow_button,
+                      "toggled",
+                      G_CALLBACK (on_overflow_button_toggled),
+                      plugin);
+
     gtk_container_add (GTK_CONTAINER (plugin),
-                       plugin->icon_box);
+                       plugin->main_box);
+
+    g_signal_connect_after (plugin,
+                            "size-allocate",
+                            G_CALLBACK (on_plugin_size_allocate),
+                            NULL);
 
     gtk_widget_show_all (GTK_WIDGET (plugin));
 
@@ -335,6 +1130,75 @@ xapp_status_plugin_construct (XfcePanelPlugin *panel_plugin)
 
     plugin->settings = g_settings_new (SETTINGS_SCHEMA);
 
+    update_icon_sizes (plugin);
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_COLOR_ICON_SIZE,
+                      G_CALLBACK (on_icon_size_setting_changed),
+                      plugin);
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_SYMBOLIC_ICON_SIZE,
+                      G_CALLBACK (on_icon_size_setting_changed),
+                      plugin);
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_IMAGE_CACHE_SIZE,
+                      G_CALLBACK (on_image_cache_size_changed),
+                      plugin);
+    on_image_cache_size_changed (plugin->settings, KEY_IMAGE_CACHE_SIZE, plugin);
+
+    // Map the last session's pixels while the first icons are looked up.
+    pixel_cache_load ();
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_MAX_ICON_UPDATE_RATE,
+                      G_CALLBACK (on_max_update_rate_changed),
+                      plugin);
+    on_max_update_rate_changed (plugin->settings, KEY_MAX_ICON_UPDATE_RATE, plugin);
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_STABLE_LABEL_WIDTH,
+                      G_CALLBACK (on_stable_label_width_changed),
+                      plugin);
+    on_stable_label_width_changed (plugin->settings, KEY_STABLE_LABEL_WIDTH, plugin);
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_DEBUG_STATISTICS,
+                      G_CALLBACK (on_debug_statistics_changed),
+                      plugin);
+    on_debug_statistics_changed (plugin->settings, KEY_DEBUG_STATISTICS, plugin);
+
+    g_signal_connect (plugin->settings,
+                      "changed::" KEY_MAX_INLINE_ICONS,
+                      G_CALLBACK (on_max_inline_icons_changed),
+                      plugin);
+    on_max_inline_icons_changed (plugin->settings, KEY_MAX_INLINE_ICONS, plugin);
+
+    load_placeholders (plugin);
+
+    plugin->registry = icon_registry_get ();
+
+    g_signal_connect (plugin->registry,
+                      "icon-added",
+                      G_CALLBACK (on_icon_added),
+                      plugin);
+
+
+    g_signal_connect (plugin->registry,
+                      "icon-removed",
+                      G_CALLBACK (on_icon_removed),
+                      plugin);
+
+    // Another instance may have found some icons already.
+    icons = icon_registry_get_icons (plugin->registry);
+
+    for (l = icons; l != NULL; l = l->next)
+    {
+        on_icon_added (plugin->registry, l->data, plugin);
+    }
+
+    g_list_free (icons);
+
     xfce_panel_plugin_menu_show_configure (panel_plugin);
     xfce_panel_plugin_menu_show_about (panel_plugin);
 }
@@ -344,41 +1208,88 @@ static void
 xapp_status_plugin_free_data (XfcePanelPlugin *panel_plugin)
 {
   XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (panel_plugin);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (plugin->layout_idle_id > 0)
+  {
+      g_source_remove (plugin->layout_idle_id);
+      plugin->layout_idle_id = 0;
+  }
+
+  if (plugin->placeholder_timeout_id > 0)
+  {
+      g_source_remove (plugin->placeholder_timeout_id);
+      plugin->placeholder_timeout_id = 0;
+  }
+
+  if (plugin->snapshot_save_id > 0)
+  {
+      g_source_remove (plugin->snapshot_save_id);
+      plugin->snapshot_save_id = 0;
+  }
+
+  g_clear_pointer (&plugin->debug_statistics, debug_statistics_free);
+
+  if (plugin->registry != NULL)
+  {
+      g_signal_handlers_disconnect_by_data (plugin->registry, plugin);
+      g_clear_object (&plugin->registry);
+  }
+
+  g_hash_table_iter_init (&iter, plugin->lookup_table);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+  {
+      destroy_icon (plugin, value);
+      icon_entry_free (value);
+  }
 
-  g_clear_object (&plugin->monitor);
   g_hash_table_destroy (plugin->lookup_table);
+  g_sequence_free (plugin->icon_order);
   g_clear_object (&plugin->settings);
 }
 
-static void
-xapp_status_plugin_screen_position_changed (XfcePanelPlugin   *panel_plugin,
-                                                   XfceScreenPosition position)
+static GtkPositionType
+get_icon_orientation (XfceScreenPosition position)
 {
-    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (panel_plugin);
-    GtkPositionType xapp_orientation = GTK_POS_TOP;
-    GtkOrientation widget_orientation = GTK_ORIENTATION_HORIZONTAL;
-    GHashTableIter iter;
-    gpointer key, value;
-
     if (xfce_screen_position_is_top (position))
     {
-        xapp_orientation = GTK_POS_TOP;
+        return GTK_POS_TOP;
     }
     else
     if (xfce_screen_position_is_bottom (position))
     {
-        xapp_orientation = GTK_POS_BOTTOM;
+        return GTK_POS_BOTTOM;
     }
     else
     if (xfce_screen_position_is_left (position))
     {
-        xapp_orientation = GTK_POS_LEFT;
-        widget_orientation = GTK_ORIENTATION_VERTICAL;
+        return GTK_POS_LEFT;
     }
     else
     if (xfce_screen_position_is_right (position))
     {
-        xapp_orientation = GTK_POS_RIGHT;
+        return GTK_POS_RIGHT;
+    }
+
+    return GTK_POS_TOP;
+}
+
+static void
+xapp_status_plugin_screen_position_changed (XfcePanelPlugin   *panel_plugin,
+                                                   XfceScreenPosition position)
+{
+    XAppStatusPlugin *plugin = XAPP_STATUS_PLUGIN (panel_plugin);
+    GtkPositionType xapp_orientation;
+    GtkOrientation widget_orientation = GTK_ORIENTATION_HORIZONTAL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    xapp_orientation = get_icon_orientation (position);
+
+    if (xapp_orientation == GTK_POS_LEFT || xapp_orientation == GTK_POS_RIGHT)
+    {
         widget_orientation = GTK_ORIENTATION_VERTICAL;
     }
 
@@ -386,12 +1297,17 @@ xapp_status_plugin_screen_position_changed (XfcePanelPlugin   *panel_plugin,
 
     while (g_hash_table_iter_next (&iter, &key, &value))
     {
-        StatusIcon *icon = STATUS_ICON (value);
+        IconEntry *entry = value;
 
-        status_icon_set_orientation (icon, xapp_orientation);
+        if (entry->icon != NULL)
+        {
+            status_icon_set_orientation (entry->icon, xapp_orientation);
+        }
     }
 
-    gtk_orientable_set_orientation (GTK_ORIENTABLE (plugin->icon_box),
+    status_icon_box_set_orientation (STATUS_ICON_BOX (plugin->icon_box),
+                                     widget_orientation);
+    gtk_orientable_set_orientation (GTK_ORIENTABLE (plugin->main_box),
                                     widget_orientation);
 }
 
@@ -403,25 +1319,47 @@ xapp_status_plugin_size_changed (XfcePanelPlugin *panel_plugin,
 
     GHashTableIter iter;
     gpointer key, value;
-    GtkOrientation orientation = xfce_panel_plugin_get_orientation (panel_plugin);
-    gint max_size;
 
-    max_size = size / xfce_panel_plugin_get_nrows (panel_plugin);
+    applet->size_passes++;
+
+    PROFILE_BEGIN (profile_begin);
+
+    update_icon_sizes (applet);
+
+    // One slot size for every icon, the boxes queue their own resize if it changed.
+    status_icon_box_set_slot_size (STATUS_ICON_BOX (applet->icon_box), get_slot_size (applet));
+
+    if (applet->overflow_box != NULL)
+    {
+        status_icon_box_set_slot_size (STATUS_ICON_BOX (applet->overflow_box), get_slot_size (applet));
+    }
 
     g_hash_table_iter_init (&iter, applet->lookup_table);
 
     while (g_hash_table_iter_next (&iter, &key, &value))
     {
-        StatusIcon *icon = STATUS_ICON (value);
-
-        gtk_widget_set_size_request (GTK_WIDGET (icon), max_size, max_size);
+        IconEntry *entry = value;
+
+        // Only reloads the image if the size actually changed, and never while hidden
+        if (entry->icon != NULL)
+        {
+            status_icon_set_size (entry->icon,
+                                  applet->color_icon_size,
+                                  applet->symbolic_icon_size);
+        }
+
+        // Their length was measured for the old size.
+        entry->length = 0;
+    }
 
-        status_icon_set_size (icon,
-                              get_color_icon_size (applet),
-                              get_symbolic_icon_size (applet));
+    // The slots changed, and with them how many icons fit.
+    if (applet->max_inline_icons < 0)
+    {
+        applet->overflow_dirty = TRUE;
+        queue_layout (applet);
     }
 
-    gtk_widget_queue_resize (GTK_WIDGET (panel_plugin));
+    PROFILE_END (profile_begin, "size-changed", NULL);
 
     return TRUE;
 }
@@ -441,11 +1379,9 @@ size_combo_changed (GtkComboBox      *combo,
                             1, &size,
                             -1);
 
+        // The icons are resized from the settings' changed signal
         g_settings_set_int (plugin->settings, key, size);
     }
-
-    xapp_status_plugin_size_changed (XFCE_PANEL_PLUGIN (plugin),
-                                     xfce_panel_plugin_get_size (XFCE_PANEL_PLUGIN (plugin)));
 }
 
 static void
@@ -508,8 +1444,7 @@ xapp_status_plugin_class_init (XAppStatusPluginClass *klass)
   plugin_class->configure_plugin = xapp_status_plugin_configure_plugin;
   plugin_class->about = xapp_status_plugin_about;
 
-    /* Initialize gettext support */
+    /* Initialize gettext support. _() names GETTEXT_PACKAGE, the panel's default domain is left alone */
   bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
   bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
-  textdomain (GETTEXT_PACKAGE);
 }